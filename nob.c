@@ -16,14 +16,21 @@
 #define STATIC_LIB_NAME "raylib.lib"
 #include <direct.h>
 #define getcwd _getcwd
+#define ENV_LIB_NAME "tetris_env.dll"
 
 #elif defined(__linux__)
 #include <unistd.h>
 #define STATIC_LIB_NAME "libraylib.a"
+#define ENV_LIB_NAME "libtetris_env.so"
 #endif
 
+#define GAME_LIB_NAME "libgame.a"
+
 #define RELEASE_FLAG "-release"
+#define HEADLESS_FLAG "-headless"
+#define NATIVE_FLAG "-native"
 #define PLATFORM_FLAG_PREFIX "-DPLATFORM_"
+#define BOARD_FLAG_PREFIX "-DBOARD_"
 #define WEB_CC "emcc"
 #define DEFAULT_CC "gcc"
 #define DESKTOP_FLAGS "-DSUPPORT_WINMM"
@@ -39,6 +46,172 @@ Nob_String_View sv = {0};
 
 bool release = false;
 bool web = false;
+bool headless = false;
+bool native = false;
+
+// -DBOARD_WIDTH=... and friends, passed to everything including game.h
+#define MAX_BOARD_DEFINES 8
+char *board_defines[MAX_BOARD_DEFINES];
+size_t board_define_count = 0;
+
+void append_board_defines(Nob_Cmd *cmd) {
+  for (size_t i = 0; i < board_define_count; i++) {
+    nob_cmd_append(cmd, board_defines[i]);
+  }
+}
+
+char *game_core_sources[] = {
+    SRC_FOLDER "game.c", SRC_FOLDER "batch.c", SRC_FOLDER "placements.c",
+    SRC_FOLDER "bot.c", SRC_FOLDER "pool.c", SRC_FOLDER "search.c",
+    SRC_FOLDER "mcts.c", SRC_FOLDER "tt.c", SRC_FOLDER "net.c",
+    SRC_FOLDER "env.c", BUILD_FOLDER "tet_tables.c"};
+char *game_core_object_files[] = {
+    BUILD_FOLDER "game.o", BUILD_FOLDER "batch.o", BUILD_FOLDER "placements.o",
+    BUILD_FOLDER "bot.o", BUILD_FOLDER "pool.o", BUILD_FOLDER "search.o",
+    BUILD_FOLDER "mcts.o", BUILD_FOLDER "tt.o", BUILD_FOLDER "net.o",
+    BUILD_FOLDER "env.o", BUILD_FOLDER "tet_tables.o"};
+// Without -pthread emscripten can't start threads, the pool then runs
+// everything on the main thread
+char *game_core_web_object_files[] = {
+    WEB_BUILD_FOLDER "game.o", WEB_BUILD_FOLDER "batch.o",
+    WEB_BUILD_FOLDER "placements.o", WEB_BUILD_FOLDER "bot.o",
+    WEB_BUILD_FOLDER "pool.o", WEB_BUILD_FOLDER "search.o",
+    WEB_BUILD_FOLDER "mcts.o", WEB_BUILD_FOLDER "tt.o",
+    WEB_BUILD_FOLDER "net.o", WEB_BUILD_FOLDER "env.o",
+    WEB_BUILD_FOLDER "tet_tables.o"};
+#define GAME_CORE_OBJ_COUNT sizeof(game_core_sources) / sizeof(char *)
+
+// Writes build/tet_tables.h and build/tet_tables.c for the board size
+bool generate_tables(Nob_Cmd *cmd) {
+  nob_log(NOB_INFO, "Generating the tetromino tables");
+  nob_cmd_append(cmd, DEFAULT_CC, SRC_FOLDER "gen_tables.c", "-o",
+                 BUILD_FOLDER "gen_tables", "-Wall", "-Wextra");
+  append_board_defines(cmd);
+  if (!nob_cmd_run_sync_and_reset(cmd))
+    return false;
+  nob_cmd_append(cmd, "./" BUILD_FOLDER "gen_tables", BUILD_FOLDER);
+  return nob_cmd_run_sync_and_reset(cmd);
+}
+
+// Game rules only, no raylib. Linked by the game and usable on its own.
+bool build_game_core(Nob_Cmd *cmd) {
+  nob_log(NOB_INFO, "Building the game core");
+  if (web) {
+    for (size_t i = 0; i < GAME_CORE_OBJ_COUNT; i++) {
+      nob_cmd_append(cmd, WEB_CC, "-c", game_core_sources[i], "-Os", "-Wall",
+                     "-o", game_core_web_object_files[i], "-I", BUILD_FOLDER,
+                     "-I", SRC_FOLDER);
+      append_board_defines(cmd);
+      sb.count = 0;
+      nob_cmd_render(*cmd, &sb);
+      nob_sb_append_null(&sb);
+      printf("System(%s)\n", sb.items);
+      if (system(sb.items) != 0) {
+        return false;
+      }
+      cmd->count = 0;
+    }
+    nob_cmd_append(cmd, "emar", "rcs", WEB_BUILD_FOLDER GAME_LIB_NAME);
+    for (size_t i = 0; i < GAME_CORE_OBJ_COUNT; i++) {
+      nob_cmd_append(cmd, game_core_web_object_files[i]);
+    }
+    sb.count = 0;
+    nob_cmd_render(*cmd, &sb);
+    nob_sb_append_null(&sb);
+    printf("System(%s)\n", sb.items);
+    if (system(sb.items) != 0) {
+      return false;
+    }
+    cmd->count = 0;
+    sb.count = 0;
+    return true;
+  }
+
+  for (size_t i = 0; i < GAME_CORE_OBJ_COUNT; i++) {
+    nob_cmd_append(cmd, DEFAULT_CC, "-c", game_core_sources[i], "-o",
+                   game_core_object_files[i], "-Wall", "-Wextra", "-I",
+                   BUILD_FOLDER, "-I", SRC_FOLDER);
+    if (release) {
+      nob_cmd_append(cmd, "-O3");
+    } else {
+      nob_cmd_append(cmd, "-g", "-ggdb");
+    }
+    // Lets batch.c use AVX2 where the build machine has it
+    if (native) {
+      nob_cmd_append(cmd, "-march=native");
+    }
+    append_board_defines(cmd);
+    if (!nob_cmd_run_sync_and_reset(cmd))
+      return false;
+  }
+
+  nob_cmd_append(cmd, "ar", "rcs", BUILD_FOLDER GAME_LIB_NAME);
+  for (size_t i = 0; i < GAME_CORE_OBJ_COUNT; i++) {
+    nob_cmd_append(cmd, game_core_object_files[i]);
+  }
+  return nob_cmd_run_sync_and_reset(cmd);
+}
+
+// Headless command line tools, each a single source linked with the core
+char *tool_names[] = {"perft", "botbench", "tune", "match", "batchbench",
+                      "netcheck", "envcheck"};
+#define TOOL_COUNT sizeof(tool_names) / sizeof(char *)
+
+bool build_tools(Nob_Cmd *cmd) {
+  nob_log(NOB_INFO, "Building the tools");
+  for (size_t i = 0; i < TOOL_COUNT; i++) {
+    sb.count = 0;
+    nob_sb_append_cstr(&sb, SRC_FOLDER);
+    nob_sb_append_cstr(&sb, tool_names[i]);
+    nob_sb_append_cstr(&sb, ".c");
+    nob_sb_append_null(&sb);
+    char *source = nob_temp_strdup(sb.items);
+    sb.count = 0;
+    nob_sb_append_cstr(&sb, BUILD_FOLDER);
+    nob_sb_append_cstr(&sb, tool_names[i]);
+    nob_sb_append_null(&sb);
+    char *output = nob_temp_strdup(sb.items);
+    sb.count = 0;
+
+    nob_cmd_append(cmd, DEFAULT_CC, source, "-o", output, "-Wall", "-Wextra",
+                   "-I", BUILD_FOLDER, "-I", SRC_FOLDER);
+    if (release) {
+      nob_cmd_append(cmd, "-O3");
+    } else {
+      nob_cmd_append(cmd, "-g", "-ggdb");
+    }
+    if (native) {
+      nob_cmd_append(cmd, "-march=native");
+    }
+    append_board_defines(cmd);
+    nob_cmd_append(cmd, "-L", BUILD_FOLDER, "-lgame", "-lpthread",
+                   "-lm");
+    if (!nob_cmd_run_sync_and_reset(cmd))
+      return false;
+  }
+  return true;
+}
+
+// The RL environment for trainers in other languages. Built from source,
+// the objects in libgame.a aren't position independent.
+bool build_env_library(Nob_Cmd *cmd) {
+  nob_log(NOB_INFO, "Building the environment library");
+  nob_cmd_append(cmd, DEFAULT_CC, "-shared", "-fPIC", "-o",
+                 BUILD_FOLDER ENV_LIB_NAME, SRC_FOLDER "env.c",
+                 SRC_FOLDER "batch.c", SRC_FOLDER "game.c",
+                 BUILD_FOLDER "tet_tables.c", "-Wall", "-Wextra", "-I",
+                 BUILD_FOLDER, "-I", SRC_FOLDER);
+  if (release) {
+    nob_cmd_append(cmd, "-O3");
+  } else {
+    nob_cmd_append(cmd, "-g", "-ggdb");
+  }
+  if (native) {
+    nob_cmd_append(cmd, "-march=native");
+  }
+  append_board_defines(cmd);
+  return nob_cmd_run_sync_and_reset(cmd);
+}
 
 int main(int argc, char **argv) {
   NOB_GO_REBUILD_URSELF(argc, argv);
@@ -53,6 +226,22 @@ int main(int argc, char **argv) {
       nob_log(NOB_INFO, "RELEASE Flag Detected");
       release = true;
     }
+    if (strcmp(NATIVE_FLAG, argv[i]) == 0) {
+      nob_log(NOB_INFO, "NATIVE Flag Detected, tuning for this CPU");
+      native = true;
+    }
+    if (strcmp(HEADLESS_FLAG, argv[i]) == 0) {
+      nob_log(NOB_INFO, "HEADLESS Flag Detected, skipping raylib and the game");
+      headless = true;
+    }
+    if (strncmp(BOARD_FLAG_PREFIX, argv[i], strlen(BOARD_FLAG_PREFIX)) == 0) {
+      if (board_define_count == MAX_BOARD_DEFINES) {
+        nob_log(NOB_ERROR, "Too many board flags");
+        return 1;
+      }
+      nob_log(NOB_INFO, "Board size: %s", argv[i]);
+      board_defines[board_define_count++] = argv[i];
+    }
     if (strncmp(PLATFORM_FLAG_PREFIX, argv[i], strlen(PLATFORM_FLAG_PREFIX)) ==
         0) {
       for (size_t p = 0; p < sizeof(platforms) / sizeof(char *); p++) {
@@ -74,6 +263,17 @@ int main(int argc, char **argv) {
 
   Nob_Cmd cmd = {0};
 
+  if (!generate_tables(&cmd))
+    return 1;
+  if (!build_game_core(&cmd))
+    return 1;
+  if (!web && !build_tools(&cmd))
+    return 1;
+  if (!web && !build_env_library(&cmd))
+    return 1;
+  if (headless)
+    return 0;
+
 #define RGLFW_INDEX 4
   char *raylib_headers[] = {
       "third_party/raylib/src/rcore.c",     "third_party/raylib/src/rshapes.c",
@@ -178,9 +378,12 @@ int main(int argc, char **argv) {
     nob_copy_file("./favicon.png", WEB_BUILD_FOLDER "/favicon.png");
     nob_cmd_append(&cmd, WEB_CC, "-o", WEB_BUILD_FOLDER "index.html",
                    SRC_FOLDER "main.c", "-Os", "-Wall",
+                   WEB_BUILD_FOLDER GAME_LIB_NAME,
                    WEB_BUILD_FOLDER STATIC_LIB_NAME, "-s", "USE_GLFW=3", "-I",
-                   "./third_party/raylib/src/", "--shell-file", "./shell.html",
+                   "./third_party/raylib/src/", "-I", BUILD_FOLDER,
+                   "--shell-file", "./shell.html",
                    "-L", "./" WEB_BUILD_FOLDER STATIC_LIB_NAME, platform);
+    append_board_defines(&cmd);
     nob_cmd_render(cmd, &sb);
     nob_sb_append_null(&sb);
     sv = nob_sb_to_sv(sb);
@@ -204,6 +407,7 @@ int main(int argc, char **argv) {
 
   nob_cmd_append(&cmd, DEFAULT_CC, "-o", BUILD_FOLDER "tetris",
                  SRC_FOLDER "main.c");
+  append_board_defines(&cmd);
 
   if (!release) {
     nob_cmd_append(&cmd, "-g", "-ggdb", "-Wall", "-Wextra");
@@ -211,11 +415,11 @@ int main(int argc, char **argv) {
   if (release) {
     nob_cmd_append(&cmd, "-O3");
   }
-  nob_cmd_append(&cmd, "-I", ".", "-I", "./third_party/raylib/src/", "-L",
-                 BUILD_FOLDER, "-lraylib");
+  nob_cmd_append(&cmd, "-I", ".", "-I", "./third_party/raylib/src/", "-I",
+                 BUILD_FOLDER, "-L", BUILD_FOLDER, "-lgame", "-lraylib");
 #ifdef _WIN32
   nob_cmd_append(&cmd, BUILD_FOLDER "resource.o", "-lopengl32", "-lgdi32",
-                 "-lwinmm", "-static");
+                 "-lwinmm", "-lpthread", "-static");
   if (release) {
     nob_cmd_append(&cmd, "-mwindows");
   }
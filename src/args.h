@@ -0,0 +1,42 @@
+#ifndef ARGS_H_
+#define ARGS_H_
+
+// Command line arguments of the tools, taken whole or refused, so a typo or
+// a flag like -h gets the usage instead of being read as 0 or as a path.
+
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Unsigned decimal, or hex after 0x
+static inline bool arg_count(const char *arg, uint64_t *value) {
+  if (arg[0] < '0' || arg[0] > '9')
+    return false;
+  char *end;
+  errno = 0;
+  unsigned long long v = strtoull(arg, &end, 0);
+  if (*end != '\0' || errno != 0)
+    return false;
+  *value = v;
+  return true;
+}
+
+// Any finite number, with a sign if it likes
+static inline bool arg_number(const char *arg, double *value) {
+  char *end;
+  errno = 0;
+  double v = strtod(arg, &end);
+  if (end == arg || *end != '\0' || errno != 0 || !isfinite(v))
+    return false;
+  *value = v;
+  return true;
+}
+
+// A path or a name, which can't look like a flag
+static inline bool arg_name(const char *arg) {
+  return arg[0] != '\0' && arg[0] != '-';
+}
+
+#endif // ARGS_H_
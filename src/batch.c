@@ -0,0 +1,412 @@
+#include "batch.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Lanes per vector and the compare that matches the Row width
+#define ROWS_PER_M256 (32 / sizeof(Row))
+#define ROWS_PER_M128 (16 / sizeof(Row))
+#if ROW_BITS == 16
+#define mm256_set1_row(v) _mm256_set1_epi16((short)(v))
+#define mm256_cmpeq_row _mm256_cmpeq_epi16
+#define mm_set1_row(v) _mm_set1_epi16((short)(v))
+#define mm_cmpeq_row _mm_cmpeq_epi16
+#elif ROW_BITS == 32
+#define mm256_set1_row(v) _mm256_set1_epi32((int)(v))
+#define mm256_cmpeq_row _mm256_cmpeq_epi32
+#define mm_set1_row(v) _mm_set1_epi32((int)(v))
+#define mm_cmpeq_row _mm_cmpeq_epi32
+#else
+#define mm256_set1_row(v) _mm256_set1_epi64x((long long)(v))
+#define mm256_cmpeq_row _mm256_cmpeq_epi64
+#define mm_set1_row(v) _mm_set1_epi64x((long long)(v))
+#if defined(__SSE2__) && !defined(__AVX2__)
+// SSE2 has no 64 bit compare, both halves have to match
+static inline __m128i mm_cmpeq_row(__m128i a, __m128i b) {
+  __m128i eq = _mm_cmpeq_epi32(a, b);
+  return _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+}
+#endif
+#endif
+
+static void lane_spawn(Batch *b, size_t lane) {
+  size_t n = b->lanes;
+  if (b->bag_used[lane] == 7) {
+    uint8_t types[7];
+    shuffle_tetromino_types(types, &b->rng[lane]);
+    for (size_t i = 0; i < 7; i++) {
+      b->bag[i * n + lane] = types[i];
+    }
+    b->bag_used[lane] = 0;
+  }
+  uint8_t type = b->bag[b->bag_used[lane]++ * n + lane];
+  b->type[lane] = type;
+  b->state[lane] = 0;
+  b->x[lane] = tet_spawn_x[type];
+  b->y[lane] = 0;
+}
+
+static void lane_reset(Batch *b, size_t lane) {
+  for (size_t y = 0; y < BOARD_ROWS + 3; y++) {
+    b->rows[y * b->lanes + lane] = 0;
+  }
+  b->bag_used[lane] = 7;
+  b->pieces[lane] = 0;
+  b->lines[lane] = 0;
+  lane_spawn(b, lane);
+}
+
+bool batch_init(Batch *b, size_t count, uint64_t seed) {
+  *b = (Batch){0};
+  size_t lanes =
+      (count + BATCH_LANE_ALIGN - 1) / BATCH_LANE_ALIGN * BATCH_LANE_ALIGN;
+  b->count = count;
+  b->lanes = lanes;
+
+  // One more row for the 32 bit gathers of 16 bit rows
+  b->rows = calloc((BOARD_ROWS + 3) * lanes + 1, sizeof(Row));
+  b->type = calloc(lanes, 1);
+  b->state = calloc(lanes, 1);
+  b->x = calloc(lanes, 1);
+  b->y = calloc(lanes, 1);
+  b->bag = calloc(7 * lanes, 1);
+  b->bag_used = calloc(lanes, 1);
+  b->rng = calloc(lanes, sizeof(Rng));
+  b->pieces = calloc(lanes, sizeof(uint32_t));
+  b->lines = calloc(lanes, sizeof(uint32_t));
+  b->done = calloc(lanes, 1);
+  b->mask_rows = calloc(4 * lanes, sizeof(Row));
+  b->board_rows = calloc(4 * lanes, sizeof(Row));
+  b->next_x = calloc(lanes, 1);
+  b->next_y = calloc(lanes, 1);
+  b->next_state = calloc(lanes, 1);
+  b->hit = calloc(lanes, sizeof(Row));
+  b->locked = calloc(lanes, 1);
+  if (!b->rows || !b->type || !b->state || !b->x || !b->y || !b->bag ||
+      !b->bag_used || !b->rng || !b->pieces || !b->lines || !b->done ||
+      !b->mask_rows || !b->board_rows || !b->next_x || !b->next_y ||
+      !b->next_state || !b->hit || !b->locked) {
+    batch_free(b);
+    return false;
+  }
+
+  for (size_t lane = 0; lane < count; lane++) {
+    rng_seed(&b->rng[lane], seed + lane);
+    lane_reset(b, lane);
+  }
+  return true;
+}
+
+void batch_reset_lane(Batch *b, size_t lane, uint64_t seed) {
+  rng_seed(&b->rng[lane], seed);
+  lane_reset(b, lane);
+}
+
+void batch_free(Batch *b) {
+  free(b->rows);
+  free(b->type);
+  free(b->state);
+  free(b->x);
+  free(b->y);
+  free(b->bag);
+  free(b->bag_used);
+  free(b->rng);
+  free(b->pieces);
+  free(b->lines);
+  free(b->done);
+  free(b->mask_rows);
+  free(b->board_rows);
+  free(b->next_x);
+  free(b->next_y);
+  free(b->next_state);
+  free(b->hit);
+  free(b->locked);
+  *b = (Batch){0};
+}
+
+#if defined(__AVX2__) && ROW_BITS <= 32
+// batch_collide for 8 lanes per instruction: the mask entries and the board
+// rows under them are fetched with gathers, the lanes whose piece is off the
+// board are masked out of them and hit. A 16 bit row is gathered as 32 bits
+// and the 16 after it cleared. Returns the lanes done, a multiple of 8.
+static size_t collide_gathered(Batch *b) {
+  size_t n = b->lanes, count = b->count;
+  const char *masks = (const char *)tet_masks;
+  __m256i full = _mm256_set1_epi32((int)FULL_ROW);
+  __m256i ones = _mm256_set1_epi32(-1);
+  __m256i byte = _mm256_set1_epi32(0xFF);
+  __m256i stride = _mm256_set1_epi32((int)n);
+  __m256i lane_offsets = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  size_t lane = 0;
+  for (; lane + 8 <= count; lane += 8) {
+    __m256i type = _mm256_cvtepu8_epi32(
+        _mm_loadl_epi64((const __m128i *)&b->type[lane]));
+    __m256i state = _mm256_cvtepu8_epi32(
+        _mm_loadl_epi64((const __m128i *)&b->next_state[lane]));
+    __m256i x = _mm256_cvtepi8_epi32(
+        _mm_loadl_epi64((const __m128i *)&b->next_x[lane]));
+    __m256i y = _mm256_cvtepi8_epi32(
+        _mm_loadl_epi64((const __m128i *)&b->next_y[lane]));
+
+    // tetromino_mask, with the columns it has no entry for sent to entry 0
+    __m256i x_valid = _mm256_and_si256(
+        _mm256_cmpgt_epi32(x, _mm256_set1_epi32(-TET_MASK_X_BIAS - 1)),
+        _mm256_cmpgt_epi32(_mm256_set1_epi32(BOARD_WIDTH), x));
+    __m256i column = _mm256_and_si256(
+        _mm256_add_epi32(x, _mm256_set1_epi32(TET_MASK_X_BIAS)), x_valid);
+    __m256i index = _mm256_add_epi32(
+        _mm256_mullo_epi32(
+            _mm256_add_epi32(
+                _mm256_mullo_epi32(type, _mm256_set1_epi32(TET_MAX_STATES)),
+                state),
+            _mm256_set1_epi32(TET_MASK_X_COUNT)),
+        column);
+    __m256i offset =
+        _mm256_mullo_epi32(index, _mm256_set1_epi32(sizeof(Tet_Mask)));
+
+    // top, bottom and fits are adjacent bytes
+    __m256i info = _mm256_i32gather_epi32(
+        (const int *)(masks + offsetof(Tet_Mask, top)), offset, 1);
+    __m256i top = _mm256_srai_epi32(_mm256_slli_epi32(info, 24), 24);
+    __m256i bottom = _mm256_srai_epi32(_mm256_slli_epi32(info, 16), 24);
+    __m256i fits = _mm256_and_si256(_mm256_srli_epi32(info, 16), byte);
+    __m256i first = _mm256_add_epi32(y, top);
+    __m256i valid = _mm256_andnot_si256(
+        _mm256_cmpeq_epi32(fits, _mm256_setzero_si256()), x_valid);
+    valid = _mm256_and_si256(valid,
+                             _mm256_cmpgt_epi32(first, _mm256_set1_epi32(-1)));
+    valid = _mm256_and_si256(
+        valid, _mm256_cmpgt_epi32(_mm256_set1_epi32(BOARD_ROWS),
+                                  _mm256_add_epi32(y, bottom)));
+
+    __m256i row = _mm256_add_epi32(
+        _mm256_mullo_epi32(first, stride),
+        _mm256_add_epi32(_mm256_set1_epi32((int)lane), lane_offsets));
+    __m256i acc = _mm256_setzero_si256();
+    for (size_t k = 0; k < 4; k++) {
+      __m256i mask_row = _mm256_mask_i32gather_epi32(
+          _mm256_setzero_si256(),
+          (const int *)(masks + offsetof(Tet_Mask, rows) + k * sizeof(Row)),
+          offset, valid, 1);
+      __m256i board_row = _mm256_mask_i32gather_epi32(
+          _mm256_setzero_si256(), (const int *)b->rows, row, valid,
+          sizeof(Row));
+      acc = _mm256_or_si256(acc, _mm256_and_si256(mask_row, board_row));
+      row = _mm256_add_epi32(row, stride);
+    }
+    acc = _mm256_and_si256(acc, full);
+    __m256i hit = _mm256_or_si256(acc, _mm256_andnot_si256(valid, ones));
+#if ROW_BITS == 16
+    // The signed pack keeps nonzero nonzero
+    _mm_storeu_si128((__m128i *)&b->hit[lane],
+                     _mm_packs_epi32(_mm256_castsi256_si128(hit),
+                                     _mm256_extracti128_si256(hit, 1)));
+#else
+    _mm256_storeu_si256((__m256i *)&b->hit[lane], hit);
+#endif
+  }
+  return lane;
+}
+#endif
+
+// Tests every lane's piece at (next_state, next_x, next_y) and leaves the
+// result in hit. With AVX2 and rows of up to 32 bits the lanes go through
+// collide_gathered 8 at a time. Otherwise, and for the lanes left over, the
+// masks and the board rows under them are gathered lane by lane, then ANDed
+// for all lanes at once.
+static void batch_collide(Batch *b) {
+  size_t n = b->lanes, count = b->count;
+  Row *m = b->mask_rows;
+  Row *r = b->board_rows;
+  size_t first = 0;
+#if defined(__AVX2__) && ROW_BITS <= 32
+  first = collide_gathered(b);
+#endif
+
+  for (size_t lane = first; lane < count; lane++) {
+    const Tet_Mask *mask =
+        tetromino_mask(b->type[lane], b->next_state[lane], b->next_x[lane]);
+    int y = b->next_y[lane];
+    if (mask == NULL || !mask->fits || y + mask->top < 0 ||
+        y + mask->bottom >= BOARD_ROWS) {
+      // Outside the board, a full mask over a full row always hits
+      m[lane] = r[lane] = FULL_ROW;
+      for (size_t k = 1; k < 4; k++) {
+        m[k * n + lane] = r[k * n + lane] = 0;
+      }
+      continue;
+    }
+    const Row *rows = &b->rows[(y + mask->top) * n + lane];
+    for (size_t k = 0; k < 4; k++) {
+      m[k * n + lane] = mask->rows[k];
+      r[k * n + lane] = rows[k * n];
+    }
+  }
+
+  size_t lane = first;
+#if defined(__AVX2__)
+  for (; lane + ROWS_PER_M256 <= count; lane += ROWS_PER_M256) {
+    __m256i acc = _mm256_setzero_si256();
+    for (size_t k = 0; k < 4; k++) {
+      __m256i mv = _mm256_loadu_si256((const __m256i *)&m[k * n + lane]);
+      __m256i rv = _mm256_loadu_si256((const __m256i *)&r[k * n + lane]);
+      acc = _mm256_or_si256(acc, _mm256_and_si256(mv, rv));
+    }
+    _mm256_storeu_si256((__m256i *)&b->hit[lane], acc);
+  }
+#elif defined(__SSE2__)
+  for (; lane + ROWS_PER_M128 <= count; lane += ROWS_PER_M128) {
+    __m128i acc = _mm_setzero_si128();
+    for (size_t k = 0; k < 4; k++) {
+      __m128i mv = _mm_loadu_si128((const __m128i *)&m[k * n + lane]);
+      __m128i rv = _mm_loadu_si128((const __m128i *)&r[k * n + lane]);
+      acc = _mm_or_si128(acc, _mm_and_si128(mv, rv));
+    }
+    _mm_storeu_si128((__m128i *)&b->hit[lane], acc);
+  }
+#endif
+  for (; lane < count; lane++) {
+    Row acc = 0;
+    for (size_t k = 0; k < 4; k++) {
+      acc |= m[k * n + lane] & r[k * n + lane];
+    }
+    b->hit[lane] = acc;
+  }
+}
+
+// Sets hit to nonzero for every lane with at least one full row below the
+// hidden rows, checking all lanes of a row per instruction.
+static void batch_find_full_rows(Batch *b) {
+  size_t n = b->lanes, count = b->count;
+  size_t lane = 0;
+#if defined(__AVX2__)
+  __m256i full = mm256_set1_row(FULL_ROW);
+  for (; lane + ROWS_PER_M256 <= count; lane += ROWS_PER_M256) {
+    __m256i acc = _mm256_setzero_si256();
+    for (size_t y = BOARD_HEIGHT_EXTRA + 1; y < BOARD_ROWS; y++) {
+      __m256i row = _mm256_loadu_si256((const __m256i *)&b->rows[y * n + lane]);
+      acc = _mm256_or_si256(acc, mm256_cmpeq_row(row, full));
+    }
+    _mm256_storeu_si256((__m256i *)&b->hit[lane], acc);
+  }
+#elif defined(__SSE2__)
+  __m128i full = mm_set1_row(FULL_ROW);
+  for (; lane + ROWS_PER_M128 <= count; lane += ROWS_PER_M128) {
+    __m128i acc = _mm_setzero_si128();
+    for (size_t y = BOARD_HEIGHT_EXTRA + 1; y < BOARD_ROWS; y++) {
+      __m128i row = _mm_loadu_si128((const __m128i *)&b->rows[y * n + lane]);
+      acc = _mm_or_si128(acc, mm_cmpeq_row(row, full));
+    }
+    _mm_storeu_si128((__m128i *)&b->hit[lane], acc);
+  }
+#endif
+  for (; lane < count; lane++) {
+    Row acc = 0;
+    for (size_t y = BOARD_HEIGHT_EXTRA + 1; y < BOARD_ROWS; y++) {
+      acc |= b->rows[y * n + lane] == FULL_ROW;
+    }
+    b->hit[lane] = acc;
+  }
+}
+
+// Clears the full rows of one lane with the game core's own routines, on a
+// copy of the lane's rows. Only lanes batch_find_full_rows hit get here.
+static uint32_t lane_clear_full_rows(Batch *b, size_t lane) {
+  size_t n = b->lanes;
+  Row board[BOARD_ROWS];
+  for (size_t y = 0; y < BOARD_ROWS; y++) {
+    board[y] = b->rows[y * n + lane];
+  }
+  Column full = board_full_rows(board);
+  board_clear_rows(board, full);
+  for (size_t y = 0; y < BOARD_ROWS; y++) {
+    b->rows[y * n + lane] = board[y];
+  }
+  return COLUMN_POPCOUNT(full);
+}
+
+static void lane_lock(Batch *b, size_t lane) {
+  size_t n = b->lanes;
+  const Tet_Mask *mask =
+      tetromino_mask(b->type[lane], b->state[lane], b->x[lane]);
+  Row *rows = &b->rows[(b->y[lane] + mask->top) * n + lane];
+  for (size_t k = 0; k < 4; k++) {
+    rows[k * n] |= mask->rows[k];
+  }
+  b->pieces[lane]++;
+}
+
+void batch_step(Batch *b, const uint8_t *actions) {
+  size_t n = b->lanes, count = b->count;
+
+  if (actions != NULL) {
+    for (size_t lane = 0; lane < count; lane++) {
+      int state = b->state[lane];
+      int x = b->x[lane];
+      switch (actions[lane]) {
+      case BATCH_LEFT:
+        x--;
+        break;
+      case BATCH_RIGHT:
+        x++;
+        break;
+      case BATCH_ROTATE:
+        state = tet_next_state[b->type[lane]][state];
+        break;
+      }
+      b->next_state[lane] = state;
+      b->next_x[lane] = x;
+      b->next_y[lane] = b->y[lane];
+    }
+    batch_collide(b);
+    for (size_t lane = 0; lane < count; lane++) {
+      if (!b->hit[lane]) {
+        b->state[lane] = b->next_state[lane];
+        b->x[lane] = b->next_x[lane];
+      }
+    }
+  }
+
+  memcpy(b->next_state, b->state, count);
+  memcpy(b->next_x, b->x, count);
+  for (size_t lane = 0; lane < count; lane++) {
+    b->next_y[lane] = b->y[lane] + 1;
+  }
+  batch_collide(b);
+
+  bool any_locked = false;
+  for (size_t lane = 0; lane < count; lane++) {
+    b->done[lane] = false;
+    b->locked[lane] = b->hit[lane] != 0;
+    b->y[lane] += !b->locked[lane];
+  }
+  for (size_t lane = 0; lane < count; lane++) {
+    if (!b->locked[lane])
+      continue;
+    lane_lock(b, lane);
+    if (b->rows[BOARD_HEIGHT_EXTRA * n + lane]) {
+      b->done[lane] = true;
+      b->locked[lane] = false;
+      if (!b->manual_reset)
+        lane_reset(b, lane);
+      continue;
+    }
+    any_locked = true;
+  }
+  if (!any_locked)
+    return;
+
+  batch_find_full_rows(b);
+  for (size_t lane = 0; lane < count; lane++) {
+    if (!b->locked[lane])
+      continue;
+    if (b->hit[lane]) {
+      b->lines[lane] += lane_clear_full_rows(b, lane);
+    }
+    lane_spawn(b, lane);
+  }
+}
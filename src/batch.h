@@ -0,0 +1,79 @@
+#ifndef BATCH_H_
+#define BATCH_H_
+
+// Many independent games stepped in lockstep, for bots and training. Every
+// lane plays the rules of game.c without the animations: each batch_step
+// applies one action per lane and one row of gravity, locks grounded pieces,
+// clears full rows and spawns the next piece from the lane's own 7-bag.
+//
+// State is kept as structure of arrays so the collision, gravity and full
+// row kernels work on many lanes per SSE2/AVX2 instruction. Build with
+// -mavx2 (./nob -native) to get the 256-bit kernels, where collision also
+// fetches the masks and board rows of 8 lanes per gather for rows of up to
+// 32 bits. batchbench checks the lanes against game_step and times them:
+// the SSE2 build steps as little as 1.2 times as many lanes a second as
+// game_step does, the AVX2 one about twice as many.
+
+#include "game.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The arrays are padded to a multiple of this many lanes
+#define BATCH_LANE_ALIGN 32
+
+typedef enum {
+  BATCH_IDLE,
+  BATCH_LEFT,
+  BATCH_RIGHT,
+  BATCH_ROTATE,
+} Batch_Action;
+
+typedef struct {
+  // Lanes that play. The arrays are padded up to lanes, the lanes past count
+  // are never stepped.
+  size_t count;
+  size_t lanes;
+  // rows[y * lanes + lane], padded like Game_State.board
+  Row *rows;
+
+  // Falling piece
+  uint8_t *type;
+  uint8_t *state;
+  int8_t *x;
+  int8_t *y;
+
+  // bag[i * lanes + lane] is the i-th Tet_Type of the lane's current bag
+  uint8_t *bag;
+  uint8_t *bag_used;
+  Rng *rng;
+
+  uint32_t *pieces;
+  uint32_t *lines;
+  // Set when the lane topped out during the last step. The lane has already
+  // been restarted with a fresh board, unless manual_reset is set.
+  uint8_t *done;
+  // Leaves the lanes that top out to the caller: batch_step only sets done,
+  // and batch_reset_lane has to restart them before the next step
+  bool manual_reset;
+
+  // Kernel scratch, mask_rows and board_rows are [4][lanes], the rest [lanes]
+  Row *mask_rows;
+  Row *board_rows;
+  int8_t *next_x;
+  int8_t *next_y;
+  uint8_t *next_state;
+  // Nonzero where the candidate placement collides
+  Row *hit;
+  uint8_t *locked;
+} Batch;
+
+// count lanes, lane i seeded with seed + i. Returns false if out of memory.
+bool batch_init(Batch *b, size_t count, uint64_t seed);
+void batch_free(Batch *b);
+// actions may be NULL to only apply gravity
+void batch_step(Batch *b, const uint8_t *actions);
+// Restarts one lane with a fresh board and its generator seeded with seed
+void batch_reset_lane(Batch *b, size_t lane, uint64_t seed);
+
+#endif // BATCH_H_
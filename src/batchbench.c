@@ -0,0 +1,234 @@
+// batchbench: checks the batch simulator against game_step and times it.
+//
+//   ./build/batchbench [lanes] [steps] [check_steps] [seed]
+//
+// The check plays CHECK_LANES games in lockstep, each once in a batch lane
+// and once on a Game_State driven tick by tick, and compares boards, falling
+// pieces, bags, lines and top outs after every step. The actions steer each
+// piece to where the greedy bot would place it, with some random ones mixed
+// in, so games clear lines and top out too. A game that tops out restarts
+// on both sides from the next seed.
+//
+// The timing steps lanes games with random actions for steps steps, first
+// through batch_step, then one Game_State at a time the way the check does,
+// and gives the lane steps and the pieces placed per second of each.
+
+#include "args.h"
+#include "batch.h"
+#include "bot.h"
+#include "game.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define CHECK_LANES 64
+// One action in this many is random
+#define NOISE 8
+
+// One batch_step on the real game: the action on a tick without gravity,
+// then a tick of gravity, then the clear animation played out. Returns true
+// when the piece topped out.
+static bool reference_step(Game_State *g, uint8_t action) {
+  Game_Input input = {
+      .rotate_pressed = action == BATCH_ROTATE,
+      .left_pressed = action == BATCH_LEFT,
+      .right_pressed = action == BATCH_RIGHT,
+  };
+  g->tick_time = false;
+  g->last_tick_time = 0;
+  game_step(g, input);
+  g->last_tick_time = g->gravity_ticks;
+  game_step(g, (Game_Input){0});
+  if (g->game_over_animation)
+    return true;
+  while (g->clear_animation) {
+    g->tick_time = false;
+    g->last_tick_time = 0;
+    game_step(g, (Game_Input){0});
+  }
+  return false;
+}
+
+static bool lane_matches(const Batch *b, size_t lane, const Game_State *g,
+                         bool done) {
+  size_t n = b->lanes;
+  for (size_t y = 0; y < BOARD_ROWS; y++) {
+    if (b->rows[y * n + lane] != g->board[y])
+      return false;
+  }
+  if (b->done[lane] != done ||
+      b->lines[lane] != g->points / CLEAR_LINE_POINTS)
+    return false;
+  // A topped out game keeps the piece it locked, the batch the next one
+  if (done)
+    return true;
+  if (b->type[lane] != g->tetromino.type ||
+      b->state[lane] != g->tetromino.state ||
+      b->x[lane] != g->tetromino.pos.x || b->y[lane] != g->tetromino.pos.y ||
+      b->bag_used[lane] != g->tetromino_bag_used)
+    return false;
+  for (int i = b->bag_used[lane]; i < 7; i++) {
+    if (b->bag[i * n + lane] != g->tetromino_bag[i].type)
+      return false;
+  }
+  return true;
+}
+
+static uint8_t steer(const Tetromino *piece, Tetromino target, Rng *rng) {
+  if (rng_below(rng, NOISE) == 0)
+    return rng_below(rng, BATCH_ROTATE + 1);
+  if (piece->state != target.state)
+    return BATCH_ROTATE;
+  if (piece->pos.x < target.pos.x)
+    return BATCH_RIGHT;
+  if (piece->pos.x > target.pos.x)
+    return BATCH_LEFT;
+  return BATCH_IDLE;
+}
+
+static bool check(uint64_t steps, uint64_t seed) {
+  Batch b;
+  static Game_State games[CHECK_LANES];
+  Tetromino targets[CHECK_LANES];
+  uint8_t actions[CHECK_LANES];
+  uint64_t seeds[CHECK_LANES];
+  Rng rng;
+  Bot bot;
+  if (!batch_init(&b, CHECK_LANES, seed)) {
+    fprintf(stderr, "Out of memory\n");
+    return false;
+  }
+  b.manual_reset = true;
+  bot_init(&bot, &bot_default_weights);
+  rng_seed(&rng, seed);
+  for (size_t lane = 0; lane < CHECK_LANES; lane++) {
+    seeds[lane] = seed + lane;
+    game_init(&games[lane], seeds[lane]);
+  }
+
+  uint64_t lines = 0, top_outs = 0;
+  bool ok = true;
+  for (uint64_t step = 0; step < steps && ok; step++) {
+    for (size_t lane = 0; lane < CHECK_LANES; lane++) {
+      Game_State *g = &games[lane];
+      // A fresh piece sits in its spawn row
+      if (g->tetromino.pos.y == 0 &&
+          !bot_choose(&bot, g->board, g->tetromino, &targets[lane]))
+        targets[lane] = g->tetromino;
+      actions[lane] = steer(&g->tetromino, targets[lane], &rng);
+    }
+    batch_step(&b, actions);
+    for (size_t lane = 0; lane < CHECK_LANES; lane++) {
+      Game_State *g = &games[lane];
+      bool done = reference_step(g, actions[lane]);
+      if (!lane_matches(&b, lane, g, done)) {
+        fprintf(stderr, "Lane %zu differs from game_step at step %llu\n",
+                lane, (unsigned long long)step);
+        ok = false;
+        break;
+      }
+      if (!done)
+        continue;
+      lines += b.lines[lane];
+      top_outs++;
+      seeds[lane] += CHECK_LANES;
+      game_init(g, seeds[lane]);
+      batch_reset_lane(&b, lane, seeds[lane]);
+    }
+  }
+  if (ok) {
+    for (size_t lane = 0; lane < CHECK_LANES; lane++) {
+      lines += b.lines[lane];
+    }
+    printf("check: %d lanes, %llu steps match game_step, %llu lines, "
+           "%llu top outs\n",
+           CHECK_LANES, (unsigned long long)steps, (unsigned long long)lines,
+           (unsigned long long)top_outs);
+  }
+  batch_free(&b);
+  return ok;
+}
+
+static double seconds_since(clock_t start) {
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static void random_actions(uint8_t *actions, size_t count, Rng *rng) {
+  for (size_t i = 0; i < count; i++) {
+    actions[i] = rng_below(rng, BATCH_ROTATE + 1);
+  }
+}
+
+static void report(const char *name, uint64_t lane_steps, uint64_t placed,
+                   double seconds) {
+  printf("%-10s %12.0f lane steps/s %12.0f placements/s\n", name,
+         lane_steps / seconds, placed / seconds);
+}
+
+int main(int argc, char **argv) {
+  uint64_t lanes = 4096, steps = 1000, check_steps = 20000, seed = 1;
+  if (argc > 5 || (argc > 1 && !arg_count(argv[1], &lanes)) ||
+      (argc > 2 && !arg_count(argv[2], &steps)) ||
+      (argc > 3 && !arg_count(argv[3], &check_steps)) ||
+      (argc > 4 && !arg_count(argv[4], &seed)) || lanes == 0) {
+    fprintf(stderr, "Usage: %s [lanes] [steps] [check_steps] [seed]\n",
+            argv[0]);
+    return 1;
+  }
+
+  if (!check(check_steps, seed))
+    return 1;
+
+  Batch b;
+  uint8_t *actions = malloc(lanes);
+  Game_State *games = malloc(lanes * sizeof(Game_State));
+  if (actions == NULL || games == NULL || !batch_init(&b, lanes, seed)) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+  Rng rng;
+  rng_seed(&rng, seed);
+  uint64_t placed = 0;
+  double seconds = 0;
+  for (uint64_t step = 0; step < steps; step++) {
+    random_actions(actions, lanes, &rng);
+    clock_t start = clock();
+    batch_step(&b, actions);
+    seconds += seconds_since(start);
+    for (size_t lane = 0; lane < lanes; lane++) {
+      placed += b.locked[lane] | b.done[lane];
+    }
+  }
+  printf("%llu lanes, %llu steps\n", (unsigned long long)lanes,
+         (unsigned long long)steps);
+  report("batch", lanes * steps, placed, seconds);
+
+  rng_seed(&rng, seed);
+  for (size_t lane = 0; lane < lanes; lane++) {
+    game_init(&games[lane], seed + lane);
+  }
+  placed = 0;
+  seconds = 0;
+  for (uint64_t step = 0; step < steps; step++) {
+    random_actions(actions, lanes, &rng);
+    clock_t start = clock();
+    for (size_t lane = 0; lane < lanes; lane++) {
+      Game_State *g = &games[lane];
+      if (reference_step(g, actions[lane])) {
+        game_init(g, seed + lane);
+        placed++;
+        continue;
+      }
+      // A piece that didn't lock fell a row, the next one is at the top
+      placed += g->tetromino.pos.y == 0;
+    }
+    seconds += seconds_since(start);
+  }
+  report("game_step", lanes * steps, placed, seconds);
+
+  batch_free(&b);
+  free(actions);
+  free(games);
+  return 0;
+}
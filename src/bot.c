@@ -0,0 +1,247 @@
+#include "bot.h"
+#include <float.h>
+#include <string.h>
+
+const Bot_Weights bot_default_weights = {
+    .aggregate_height = -0.5f,
+    .holes = -7.5f,
+    .bumpiness = -0.5f,
+    .row_transitions = -3.0f,
+    .column_transitions = -9.0f,
+    .wells = -3.5f,
+    .lines = 3.5f,
+};
+
+#define ALL_ROWS ((Column)(((Column)2 << (BOARD_ROWS - 1)) - 1))
+#define FLOOR_ROW ((Column)1 << (BOARD_ROWS - 1))
+
+void bot_init(Bot *bot, const Bot_Weights *weights) {
+  bot->weights = *weights;
+  bot->count = 0;
+}
+
+// Branch free, unlike __builtin_popcount it vectorises without AVX-512
+static inline Column column_popcount(Column v) {
+  v = v - ((v >> 1) & (Column)0x5555555555555555ull);
+  v = (v & (Column)0x3333333333333333ull) +
+      ((v >> 2) & (Column)0x3333333333333333ull);
+  v = (v + (v >> 4)) & (Column)0x0F0F0F0F0F0F0F0Full;
+  return (Column)(v * (Column)0x0101010101010101ull) >> (COLUMN_BITS - 8);
+}
+
+// Rows from the bottom up to and including the top cell
+static inline Column column_height(Column column) {
+  // Spelled out, the vectoriser gives up on loops nested in its loop
+  column |= column << 1;
+  column |= column << 2;
+  column |= column << 4;
+  column |= column << 8;
+  column |= column << 16;
+#if COLUMN_BITS > 32
+  column |= column << 32;
+#endif
+  return column_popcount(column & ALL_ROWS);
+}
+
+// Locks each placement into a copy of the board's columns and clears its
+// full rows
+static void build_candidates(Bot *bot, const Row *board) {
+  Column base[BOARD_WIDTH] = {0};
+  for (int y = 0; y < BOARD_ROWS; y++) {
+    for (Row row = board[y]; row; row &= row - 1) {
+      base[ROW_CTZ(row)] |= (Column)1 << y;
+    }
+  }
+
+  for (size_t i = 0; i < bot->count; i++) {
+    Tetromino p = bot->placements[i];
+    const Tet_Mask *mask = tetromino_mask(p.type, p.state, p.pos.x);
+    const Cell *parts = tet_states[p.type][p.state];
+    int top = p.pos.y + mask->top;
+
+    Column full = 0;
+    for (int k = 0; k <= mask->bottom - mask->top; k++) {
+      int y = top + k;
+      full |= (Column)(y > BOARD_HEIGHT_EXTRA &&
+                       (board[y] | mask->rows[k]) == FULL_ROW)
+              << y;
+    }
+    int top_out_k = BOARD_HEIGHT_EXTRA - top;
+    bot->topped_out[i] =
+        board[BOARD_HEIGHT_EXTRA] ||
+        (top_out_k >= 0 && top_out_k < 4 && mask->rows[top_out_k]);
+    bot->lines[i] = COLUMN_POPCOUNT(full);
+
+    for (int x = 0; x < BOARD_WIDTH; x++) {
+      bot->columns[x][i] = base[x];
+    }
+    for (size_t k = 0; k < 4; k++) {
+      bot->columns[p.pos.x + parts[k].x][i] |= (Column)1
+                                               << (p.pos.y + parts[k].y);
+    }
+    if (full) {
+      for (int x = 0; x < BOARD_WIDTH; x++) {
+        bot->columns[x][i] = column_remove_rows(bot->columns[x][i], full);
+      }
+    }
+  }
+}
+
+static void score_candidates(Bot *bot) {
+  size_t n = bot->count;
+  // Every array is separate, telling the compiler lets it vectorise
+  int32_t *restrict aggregate_height = bot->aggregate_height;
+  int32_t *restrict holes = bot->holes;
+  int32_t *restrict bumpiness = bot->bumpiness;
+  int32_t *restrict row_transitions = bot->row_transitions;
+  int32_t *restrict column_transitions = bot->column_transitions;
+  int32_t *restrict wells = bot->wells;
+  memset(aggregate_height, 0, n * sizeof(int32_t));
+  memset(holes, 0, n * sizeof(int32_t));
+  memset(bumpiness, 0, n * sizeof(int32_t));
+  memset(row_transitions, 0, n * sizeof(int32_t));
+  memset(column_transitions, 0, n * sizeof(int32_t));
+  memset(wells, 0, n * sizeof(int32_t));
+
+  for (int x = 0; x < BOARD_WIDTH; x++) {
+    const Column *restrict column = bot->columns[x];
+    int32_t *restrict height = bot->heights[x];
+    for (size_t i = 0; i < n; i++) {
+      height[i] = column_height(column[i]);
+      aggregate_height[i] += height[i];
+      holes[i] += height[i] - (int32_t)column_popcount(column[i]);
+      // The floor counts as filled, the space above the board as empty
+      column_transitions[i] += column_popcount(
+          (column[i] ^ (column[i] >> 1 | FLOOR_ROW)) & ALL_ROWS);
+    }
+  }
+
+  // Row transitions between neighbouring columns, then against the walls
+  for (int x = 0; x + 1 < BOARD_WIDTH; x++) {
+    const Column *restrict left = bot->columns[x];
+    const Column *restrict right = bot->columns[x + 1];
+    const int32_t *restrict left_height = bot->heights[x];
+    const int32_t *restrict right_height = bot->heights[x + 1];
+    for (size_t i = 0; i < n; i++) {
+      row_transitions[i] += column_popcount((left[i] ^ right[i]) & ALL_ROWS);
+      int32_t step = left_height[i] - right_height[i];
+      bumpiness[i] += step < 0 ? -step : step;
+    }
+  }
+  const Column *restrict first = bot->columns[0];
+  const Column *restrict last = bot->columns[BOARD_WIDTH - 1];
+  for (size_t i = 0; i < n; i++) {
+    row_transitions[i] += column_popcount(~first[i] & ALL_ROWS) +
+                          column_popcount(~last[i] & ALL_ROWS);
+  }
+
+  // Wells like Board_Metrics, the walls are infinitely high
+  for (int x = 0; x < BOARD_WIDTH; x++) {
+    const int32_t *restrict height = bot->heights[x];
+    const int32_t *restrict left = x > 0 ? bot->heights[x - 1] : NULL;
+    const int32_t *restrict right =
+        x + 1 < BOARD_WIDTH ? bot->heights[x + 1] : NULL;
+    for (size_t i = 0; i < n; i++) {
+      int32_t lower = BOARD_ROWS;
+      if (left != NULL && left[i] < lower)
+        lower = left[i];
+      if (right != NULL && right[i] < lower)
+        lower = right[i];
+      wells[i] += lower > height[i] ? lower - height[i] : 0;
+    }
+  }
+
+  const Bot_Weights *w = &bot->weights;
+  const int32_t *restrict lines = bot->lines;
+  const uint8_t *restrict topped_out = bot->topped_out;
+  float *restrict scores = bot->scores;
+  for (size_t i = 0; i < n; i++) {
+    float score = w->aggregate_height * aggregate_height[i] +
+                  w->holes * holes[i] + w->bumpiness * bumpiness[i] +
+                  w->row_transitions * row_transitions[i] +
+                  w->column_transitions * column_transitions[i] +
+                  w->wells * wells[i] + w->lines * lines[i];
+    scores[i] = topped_out[i] ? -FLT_MAX : score;
+  }
+}
+
+size_t bot_evaluate(Bot *bot, const Row *board, Tetromino tetromino) {
+  bot->count = generate_placements(board, tetromino, bot->placements);
+  build_candidates(bot, board);
+  score_candidates(bot);
+  return bot->count;
+}
+
+bool bot_choose(Bot *bot, const Row *board, Tetromino tetromino,
+                Tetromino *best) {
+  if (bot_evaluate(bot, board, tetromino) == 0)
+    return false;
+  size_t best_i = 0;
+  for (size_t i = 1; i < bot->count; i++) {
+    if (bot->scores[i] > bot->scores[best_i])
+      best_i = i;
+  }
+  *best = bot->placements[best_i];
+  return true;
+}
+
+Bot_Move bot_next_move(const Row *board, Tetromino from, Tetromino to) {
+  if (from.state == to.state && from.pos.x == to.pos.x &&
+      from.pos.y <= to.pos.y) {
+    int y = from.pos.y;
+    while (!tetromino_collides(board, from.type, from.state, from.pos.x, y + 1))
+      y++;
+    if (y == to.pos.y)
+      return BOT_DROP;
+  }
+
+  // Breadth first, every position remembers the move that started its path
+  static const Bot_Move moves[] = {BOT_ROTATE, BOT_LEFT, BOT_RIGHT, BOT_DOWN};
+  uint8_t first[TET_MAX_STATES][BOARD_ROWS][TET_MASK_X_COUNT] = {0};
+  Tetromino queue[TET_MAX_STATES * BOARD_ROWS * TET_MASK_X_COUNT];
+  size_t head = 0, tail = 0;
+  queue[tail++] = from;
+  first[from.state][from.pos.y][from.pos.x + TET_MASK_X_BIAS] = BOT_WAIT + 1;
+
+  while (head < tail) {
+    Tetromino t = queue[head++];
+    Bot_Move path = first[t.state][t.pos.y][t.pos.x + TET_MASK_X_BIAS] - 1;
+    for (size_t m = 0; m < sizeof(moves) / sizeof(moves[0]); m++) {
+      Tetromino n = t;
+      switch (moves[m]) {
+      case BOT_ROTATE:
+        n.state = tet_next_state[t.type][t.state];
+        break;
+      case BOT_LEFT:
+        n.pos.x--;
+        break;
+      case BOT_RIGHT:
+        n.pos.x++;
+        break;
+      default:
+        n.pos.y++;
+        break;
+      }
+      if (tetromino_collides(board, n.type, n.state, n.pos.x, n.pos.y))
+        continue;
+      uint8_t *seen = &first[n.state][n.pos.y][n.pos.x + TET_MASK_X_BIAS];
+      if (*seen)
+        continue;
+      *seen = (path == BOT_WAIT ? moves[m] : path) + 1;
+      if (n.state == to.state && n.pos.x == to.pos.x && n.pos.y == to.pos.y)
+        return *seen - 1;
+      queue[tail++] = n;
+    }
+  }
+  return BOT_WAIT;
+}
+
+Game_Input bot_input(Bot_Move move) {
+  return (Game_Input){
+      .rotate_pressed = move == BOT_ROTATE,
+      .left_pressed = move == BOT_LEFT,
+      .right_pressed = move == BOT_RIGHT,
+      .fast_down = move == BOT_DOWN,
+      .hard_drop_pressed = move == BOT_DROP,
+  };
+}
@@ -0,0 +1,75 @@
+#ifndef BOT_H_
+#define BOT_H_
+
+// Heuristic auto-player. Every placement the falling tetromino can reach is
+// scored with a weighted sum of board features and the best one is played.
+// The features of all candidates are computed together from column
+// bitboards stored candidate after candidate, so each loop runs over a plain
+// array and vectorises.
+
+#include "game.h"
+#include "placements.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+  float aggregate_height;
+  float holes;
+  float bumpiness;
+  float row_transitions;
+  float column_transitions;
+  float wells;
+  float lines;
+} Bot_Weights;
+
+extern const Bot_Weights bot_default_weights;
+
+typedef enum {
+  BOT_WAIT,
+  BOT_LEFT,
+  BOT_RIGHT,
+  BOT_ROTATE,
+  BOT_DOWN,
+  // Only falling is left, hard drop
+  BOT_DROP,
+} Bot_Move;
+
+// One evaluator's scratch space. It grows with the board, so keep it off
+// the stack.
+typedef struct {
+  Bot_Weights weights;
+
+  size_t count;
+  Tetromino placements[MAX_PLACEMENTS];
+  float scores[MAX_PLACEMENTS];
+
+  // columns[x][i] is column x of the board after placement i
+  Column columns[BOARD_WIDTH][MAX_PLACEMENTS];
+  int32_t heights[BOARD_WIDTH][MAX_PLACEMENTS];
+  uint8_t topped_out[MAX_PLACEMENTS];
+
+  int32_t lines[MAX_PLACEMENTS];
+  int32_t aggregate_height[MAX_PLACEMENTS];
+  int32_t holes[MAX_PLACEMENTS];
+  int32_t bumpiness[MAX_PLACEMENTS];
+  int32_t row_transitions[MAX_PLACEMENTS];
+  int32_t column_transitions[MAX_PLACEMENTS];
+  int32_t wells[MAX_PLACEMENTS];
+} Bot;
+
+void bot_init(Bot *bot, const Bot_Weights *weights);
+// Generates every placement of tetromino on board into bot->placements and
+// scores it into bot->scores. Placements that top out score -FLT_MAX.
+size_t bot_evaluate(Bot *bot, const Row *board, Tetromino tetromino);
+// The best scoring placement, false when tetromino has nowhere to go
+bool bot_choose(Bot *bot, const Row *board, Tetromino tetromino,
+                Tetromino *best);
+
+// First move of a shortest way from one position to a placement, BOT_WAIT
+// when it can't be reached from here
+Bot_Move bot_next_move(const Row *board, Tetromino from, Tetromino to);
+// The input that makes the move on the next tick
+Game_Input bot_input(Bot_Move move);
+
+#endif // BOT_H_
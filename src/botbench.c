@@ -0,0 +1,173 @@
+// botbench: plays the same seeded games with each bot and compares how
+// long they survive and how much they score for the CPU time they take.
+//
+//   ./build/botbench [games] [pieces] [budget_ms] [threads] [net]
+//
+// Games run piece by piece on the game core without ticks, from the pieces
+// game_init's bag hands out, and stop at top out or after pieces pieces.
+// Points are counted like game_step does. The searches get budget_ms per
+// piece on threads extra workers, by default every core. CPU time is the
+// whole process's, so a search that keeps 32 cores busy pays for all of
+// them. Both searches share one transposition table, cleared before every
+// bot so none profits from another's entries, and its hit rate is printed.
+// Given a network file (src/net.h) a fourth bot plays greedily by its
+// values, and the time it takes per position is printed.
+
+#include "args.h"
+#include "bot.h"
+#include "game.h"
+#include "mcts.h"
+#include "net.h"
+#include "search.h"
+#include "tt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef enum {
+  PLAYER_GREEDY,
+  PLAYER_BEAM,
+  PLAYER_MCTS,
+  PLAYER_NET,
+  PLAYER_COUNT,
+} Player;
+
+static const char *player_names[PLAYER_COUNT] = {"greedy", "beam", "mcts",
+                                                 "net"};
+
+static Pool pool;
+static Bot bot;
+static Search search;
+static Mcts mcts;
+static Tt tt;
+static Net net;
+static bool net_ready = false;
+// Spent in net_choose and the positions it valued there
+static double net_seconds = 0;
+static uint64_t net_positions = 0;
+
+typedef struct {
+  uint64_t pieces;
+  uint64_t points;
+  double cpu_seconds;
+} Result;
+
+static Result play(Player player, uint64_t seed, uint64_t max_pieces) {
+  Game_State g;
+  game_init(&g, seed);
+  Result result = {0};
+  clock_t start = clock();
+  while (result.pieces < max_pieces) {
+    Tetromino best;
+    bool found = false;
+    switch (player) {
+    case PLAYER_GREEDY:
+      found = bot_choose(&bot, g.board, g.tetromino, &best);
+      break;
+    case PLAYER_BEAM:
+      found = search_choose_game(&search, &g, &best);
+      break;
+    case PLAYER_NET: {
+      double start = pool_seconds();
+      found = net_choose(&net, &bot, g.board, g.tetromino,
+                         g.tetromino_bag + g.tetromino_bag_used,
+                         7 - g.tetromino_bag_used, &best);
+      net_seconds += pool_seconds() - start;
+      net_positions += bot.count;
+      break;
+    }
+    default:
+      found = mcts_choose_game(&mcts, &g, &best);
+      break;
+    }
+    if (!found)
+      break;
+    if (game_place(&g, best) < 0)
+      break;
+    result.pieces++;
+  }
+  result.points = g.points;
+  result.cpu_seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+  return result;
+}
+
+int main(int argc, char **argv) {
+  uint64_t games = 4, pieces = 1000, threads = pool_default_threads();
+  double budget = 5.0;
+  if (argc > 6 || (argc > 1 && !arg_count(argv[1], &games)) ||
+      (argc > 2 && !arg_count(argv[2], &pieces)) ||
+      (argc > 3 && !arg_number(argv[3], &budget)) ||
+      (argc > 4 && !arg_count(argv[4], &threads)) ||
+      (argc > 5 && !arg_name(argv[5])) || games == 0 || budget <= 0) {
+    fprintf(stderr,
+            "Usage: %s [games] [pieces] [budget_ms] [threads] [net]\n",
+            argv[0]);
+    return 1;
+  }
+  budget /= 1000.0;
+  if (argc > 5) {
+    net_ready = net_load(&net, argv[5]);
+    if (!net_ready) {
+      fprintf(stderr, "Can't load the network %s\n", argv[5]);
+      return 1;
+    }
+  }
+
+  pool_init(&pool, threads);
+  bot_init(&bot, &bot_default_weights);
+  if (!tt_init(&tt, TT_DEFAULT_BYTES) ||
+      !search_init(&search, &pool, &tt, &bot_default_weights,
+                   SEARCH_DEFAULT_BEAM_WIDTH, budget) ||
+      !mcts_init(&mcts, &pool, &tt, &bot_default_weights,
+                 MCTS_DEFAULT_TABLE_BITS, MCTS_DEFAULT_HORIZON, budget, 1)) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+  printf("%llu games of up to %llu pieces, %.1f ms per piece, %zu workers\n",
+         (unsigned long long)games, (unsigned long long)pieces,
+         budget * 1000.0, pool_worker_count(&pool));
+
+  for (int p = 0; p < PLAYER_COUNT; p++) {
+    if (p == PLAYER_NET && !net_ready)
+      continue;
+    Result total = {0};
+    uint64_t worst = UINT64_MAX;
+    tt_clear(&tt);
+    tt_reset_stats(&tt);
+    for (uint64_t i = 0; i < games; i++) {
+      Result r = play(p, i + 1, pieces);
+      total.pieces += r.pieces;
+      total.points += r.points;
+      total.cpu_seconds += r.cpu_seconds;
+      if (r.pieces < worst)
+        worst = r.pieces;
+    }
+    double cpu = total.cpu_seconds > 0 ? total.cpu_seconds : 1e-9;
+    printf("%-7s %10.1f pieces (worst %llu) %10.1f points %9.2f cpu s "
+           "%10.1f pieces/cpu s %10.1f points/cpu s\n",
+           player_names[p], (double)total.pieces / games,
+           (unsigned long long)worst, (double)total.points / games,
+           total.cpu_seconds, total.pieces / cpu, total.points / cpu);
+    if (p == PLAYER_NET && net_positions > 0) {
+      printf("        net: %.2f us per position\n",
+             net_seconds * 1e6 / net_positions);
+    }
+    Tt_Stats stats = tt_stats(&tt);
+    if (p != PLAYER_NET && stats.probes > 0) {
+      printf("        tt: %llu probes, %.1f%% hits, %llu stores\n",
+             (unsigned long long)stats.probes,
+             100.0 * stats.hits / stats.probes,
+             (unsigned long long)stats.stores);
+    }
+    fflush(stdout);
+  }
+
+  search_free(&search);
+  mcts_free(&mcts);
+  tt_free(&tt);
+  if (net_ready)
+    net_free(&net);
+  pool_free(&pool);
+  return 0;
+}
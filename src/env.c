@@ -0,0 +1,135 @@
+#include "env.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct Env {
+  Batch batch;
+  size_t count;
+  uint64_t *seeds;
+  uint64_t *episodes;
+  // Batch line counts after the last step, for the rewards
+  uint32_t *lines;
+};
+
+void env_info(Env_Info *info) {
+  *info = (Env_Info){
+      .board_width = BOARD_WIDTH,
+      .board_rows = BOARD_ROWS,
+      .row_bytes = sizeof(Row),
+      .preview = ENV_PREVIEW,
+      .action_count = BATCH_ROTATE + 1,
+  };
+}
+
+static uint64_t episode_seed(const Env *env, size_t i) {
+  return env->seeds[i] + env->episodes[i] * ENV_EPISODE_STRIDE;
+}
+
+Env *env_create(size_t count, const uint64_t *seeds) {
+  Env *env = calloc(1, sizeof(Env));
+  if (env == NULL)
+    return NULL;
+  if (count == 0)
+    count = 1;
+  env->count = count;
+  if (!batch_init(&env->batch, count, 0)) {
+    free(env);
+    return NULL;
+  }
+  // Restarted with the seed of the next episode instead
+  env->batch.manual_reset = true;
+  env->seeds = calloc(count, sizeof(uint64_t));
+  env->episodes = calloc(count, sizeof(uint64_t));
+  env->lines = calloc(count, sizeof(uint32_t));
+  if (!env->seeds || !env->episodes || !env->lines) {
+    env_destroy(env);
+    return NULL;
+  }
+  for (size_t i = 0; i < count; i++) {
+    env->seeds[i] = seeds != NULL ? seeds[i] : i;
+  }
+  env_reset(env, NULL, NULL);
+  return env;
+}
+
+void env_destroy(Env *env) {
+  if (env == NULL)
+    return;
+  batch_free(&env->batch);
+  free(env->seeds);
+  free(env->episodes);
+  free(env->lines);
+  free(env);
+}
+
+// The batch keeps its state lane by lane across rows, the caller wants it
+// env by env
+static void write_observations(const Env *env, const Env_Buffers *out) {
+  const Batch *b = &env->batch;
+  size_t n = b->lanes;
+  if (out->boards != NULL) {
+    for (size_t y = 0; y < BOARD_ROWS; y++) {
+      const Row *rows = &b->rows[y * n];
+      for (size_t i = 0; i < env->count; i++) {
+        out->boards[i * BOARD_ROWS + y] = rows[i];
+      }
+    }
+  }
+  if (out->pieces != NULL) {
+    for (size_t i = 0; i < env->count; i++) {
+      int8_t *piece = &out->pieces[i * 4];
+      piece[0] = (int8_t)b->type[i];
+      piece[1] = (int8_t)b->state[i];
+      piece[2] = b->x[i];
+      piece[3] = b->y[i];
+    }
+  }
+  if (out->previews != NULL) {
+    for (size_t i = 0; i < env->count; i++) {
+      uint8_t *preview = &out->previews[i * ENV_PREVIEW];
+      for (size_t k = 0; k < ENV_PREVIEW; k++) {
+        size_t slot = b->bag_used[i] + k;
+        preview[k] = slot < 7 ? b->bag[slot * n + i] : ENV_NO_PIECE;
+      }
+    }
+  }
+}
+
+void env_reset(Env *env, const uint64_t *seeds, const Env_Buffers *out) {
+  for (size_t i = 0; i < env->count; i++) {
+    if (seeds != NULL)
+      env->seeds[i] = seeds[i];
+    env->episodes[i] = 0;
+    batch_reset_lane(&env->batch, i, episode_seed(env, i));
+    env->lines[i] = 0;
+  }
+  if (out == NULL)
+    return;
+  if (out->rewards != NULL)
+    memset(out->rewards, 0, env->count * sizeof(float));
+  if (out->dones != NULL)
+    memset(out->dones, 0, env->count);
+  write_observations(env, out);
+}
+
+void env_step(Env *env, const uint8_t *actions, const Env_Buffers *out) {
+  Batch *b = &env->batch;
+  batch_step(b, actions);
+
+  for (size_t i = 0; i < env->count; i++) {
+    bool done = b->done[i];
+    // A topped out game clears nothing on its last step
+    float reward = done ? 0 : (float)(b->lines[i] - env->lines[i]);
+    if (done) {
+      env->episodes[i]++;
+      batch_reset_lane(b, i, episode_seed(env, i));
+    }
+    env->lines[i] = b->lines[i];
+    if (out != NULL && out->rewards != NULL)
+      out->rewards[i] = reward;
+    if (out != NULL && out->dones != NULL)
+      out->dones[i] = done;
+  }
+  if (out != NULL)
+    write_observations(env, out);
+}
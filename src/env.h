@@ -0,0 +1,70 @@
+#ifndef ENV_H_
+#define ENV_H_
+
+// Reinforcement learning environment over the batch simulator: one call
+// steps every game with an array of actions and writes the observations,
+// rewards and done flags into buffers the caller owns, e.g. numpy arrays
+// handed over from Python through ctypes. Nothing is allocated per step and
+// nothing is returned that the caller has to copy again.
+//
+// nob builds it with the game rules into build/libtetris_env.so
+// (tetris_env.dll on Windows). Env is opaque to callers, env_create makes
+// one. env_info tells the sizes of the board and preview, which depend on
+// the board size the library was built for.
+//
+// A step is one batch_step: the action, then one row of gravity. The reward
+// is the rows it cleared. A game that tops out reports done and is
+// restarted at once, so the observation after a done step is already the
+// first of the next episode. Episode e of env i plays the pieces of seed
+// seeds[i] + e * ENV_EPISODE_STRIDE, whatever the other envs do.
+
+#include "batch.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Pieces of the preview, at most the rest of the 7-bag
+#define ENV_PREVIEW 6
+// Preview slots past the end of the bag
+#define ENV_NO_PIECE 7
+#define ENV_EPISODE_STRIDE 0x9E3779B97F4A7C15ull
+
+typedef struct {
+  uint32_t board_width;
+  uint32_t board_rows;
+  // Bytes of one board row, bit x is column x
+  uint32_t row_bytes;
+  uint32_t preview;
+  // Batch_Action values
+  uint32_t action_count;
+} Env_Info;
+
+// Where a step writes, each [envs][...] and contiguous. Any may be NULL.
+typedef struct {
+  // [envs][board_rows] rows like Game_State.board, without the falling
+  // piece, hidden rows first
+  Row *boards;
+  // [envs][4] type, rotation state, x and y of the falling piece
+  int8_t *pieces;
+  // [envs][ENV_PREVIEW] types still in the bag, ENV_NO_PIECE past its end
+  uint8_t *previews;
+  // [envs] rows cleared by the step
+  float *rewards;
+  // [envs] 1 where the game topped out and was restarted
+  uint8_t *dones;
+} Env_Buffers;
+
+typedef struct Env Env;
+
+void env_info(Env_Info *info);
+// count games, env i seeded with seeds[i], or with i when seeds is NULL.
+// NULL when out of memory.
+Env *env_create(size_t count, const uint64_t *seeds);
+void env_destroy(Env *env);
+// Restarts every game at episode 0, with new seeds unless seeds is NULL,
+// and writes the first observations. Rewards and dones are zeroed.
+void env_reset(Env *env, const uint64_t *seeds, const Env_Buffers *out);
+// actions[i] is a Batch_Action for env i, NULL applies only gravity
+void env_step(Env *env, const uint8_t *actions, const Env_Buffers *out);
+
+#endif // ENV_H_
@@ -0,0 +1,206 @@
+// envcheck: steps the RL environment of src/env.h and checks everything it
+// writes against games driven through game_step.
+//
+//   ./build/envcheck [envs] [steps] [seed]
+//
+// Env i starts from seed + i and is mirrored by a Game_State stepped tick
+// by tick the way batchbench does. The actions steer each piece to where the
+// greedy bot would place it, with some random ones and some gravity only
+// steps mixed in, so games clear lines and top out. After every step the
+// boards, pieces, previews, rewards and dones have to match the mirrors. A
+// mirror that tops out starts over from game_init with
+// seeds[i] + episode * ENV_EPISODE_STRIDE, so the first observation of each
+// episode checks the auto-reset and its seed. Halfway env_reset restarts
+// every env at episode 0 with new seeds.
+
+#include "args.h"
+#include "bot.h"
+#include "env.h"
+#include "game.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// One action in this many is random
+#define NOISE 8
+// One step in this many passes no actions, gravity only
+#define GRAVITY_ONLY 16
+
+// One env_step on the real game: the action on a tick without gravity, then
+// a tick of gravity, then the clear animation played out. Returns true when
+// the piece topped out.
+static bool reference_step(Game_State *g, uint8_t action) {
+  Game_Input input = {
+      .rotate_pressed = action == BATCH_ROTATE,
+      .left_pressed = action == BATCH_LEFT,
+      .right_pressed = action == BATCH_RIGHT,
+  };
+  g->tick_time = false;
+  g->last_tick_time = 0;
+  game_step(g, input);
+  g->last_tick_time = g->gravity_ticks;
+  game_step(g, (Game_Input){0});
+  if (g->game_over_animation)
+    return true;
+  while (g->clear_animation) {
+    g->tick_time = false;
+    g->last_tick_time = 0;
+    game_step(g, (Game_Input){0});
+  }
+  return false;
+}
+
+static uint8_t steer(const Tetromino *piece, Tetromino target, Rng *rng) {
+  if (rng_below(rng, NOISE) == 0)
+    return rng_below(rng, BATCH_ROTATE + 1);
+  if (piece->state != target.state)
+    return BATCH_ROTATE;
+  if (piece->pos.x < target.pos.x)
+    return BATCH_RIGHT;
+  if (piece->pos.x > target.pos.x)
+    return BATCH_LEFT;
+  return BATCH_IDLE;
+}
+
+// The observation of env i against its mirror
+static bool observation_matches(const Env_Buffers *out, size_t i,
+                                const Game_State *g) {
+  const Row *board = &out->boards[i * BOARD_ROWS];
+  for (size_t y = 0; y < BOARD_ROWS; y++) {
+    if (board[y] != g->board[y])
+      return false;
+  }
+  const int8_t *piece = &out->pieces[i * 4];
+  if (piece[0] != g->tetromino.type || piece[1] != g->tetromino.state ||
+      piece[2] != g->tetromino.pos.x || piece[3] != g->tetromino.pos.y)
+    return false;
+  const uint8_t *preview = &out->previews[i * ENV_PREVIEW];
+  for (int k = 0; k < ENV_PREVIEW; k++) {
+    int slot = g->tetromino_bag_used + k;
+    int type = slot < 7 ? g->tetromino_bag[slot].type : ENV_NO_PIECE;
+    if (preview[k] != type)
+      return false;
+  }
+  return true;
+}
+
+static size_t lines_of(const Game_State *g) {
+  return g->points / CLEAR_LINE_POINTS;
+}
+
+int main(int argc, char **argv) {
+  uint64_t envs = 64, steps = 20000, seed = 1;
+  if (argc > 4 || (argc > 1 && !arg_count(argv[1], &envs)) ||
+      (argc > 2 && !arg_count(argv[2], &steps)) ||
+      (argc > 3 && !arg_count(argv[3], &seed)) || envs == 0) {
+    fprintf(stderr, "Usage: %s [envs] [steps] [seed]\n", argv[0]);
+    return 1;
+  }
+
+  uint64_t *seeds = malloc(envs * sizeof(uint64_t));
+  uint64_t *episodes = calloc(envs, sizeof(uint64_t));
+  Game_State *games = malloc(envs * sizeof(Game_State));
+  Tetromino *targets = malloc(envs * sizeof(Tetromino));
+  uint8_t *actions = malloc(envs);
+  Env_Buffers out = {
+      .boards = malloc(envs * BOARD_ROWS * sizeof(Row)),
+      .pieces = malloc(envs * 4),
+      .previews = malloc(envs * ENV_PREVIEW),
+      .rewards = malloc(envs * sizeof(float)),
+      .dones = malloc(envs),
+  };
+  if (seeds == NULL || episodes == NULL || games == NULL ||
+      targets == NULL || actions == NULL || out.boards == NULL ||
+      out.pieces == NULL || out.previews == NULL || out.rewards == NULL ||
+      out.dones == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+  for (size_t i = 0; i < envs; i++) {
+    seeds[i] = seed + i;
+  }
+  Env *env = env_create(envs, seeds);
+  if (env == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+
+  Bot bot;
+  bot_init(&bot, &bot_default_weights);
+  Rng rng;
+  rng_seed(&rng, seed);
+  uint64_t lines = 0, resets = 0;
+  bool ok = true;
+  for (uint64_t step = 0; step <= steps && ok; step++) {
+    // Step 0 only checks the first observations, the middle one env_reset
+    if (step == 0 || step == steps / 2) {
+      for (size_t i = 0; i < envs; i++) {
+        if (step != 0) {
+          lines += lines_of(&games[i]);
+          seeds[i] += envs;
+        }
+        episodes[i] = 0;
+        game_init(&games[i], seeds[i]);
+      }
+      env_reset(env, step != 0 ? seeds : NULL, &out);
+    } else {
+      bool gravity_only = rng_below(&rng, GRAVITY_ONLY) == 0;
+      for (size_t i = 0; i < envs; i++) {
+        Game_State *g = &games[i];
+        // A fresh piece sits in its spawn row
+        if (g->tetromino.pos.y == 0 &&
+            !bot_choose(&bot, g->board, g->tetromino, &targets[i]))
+          targets[i] = g->tetromino;
+        actions[i] =
+            gravity_only ? BATCH_IDLE : steer(&g->tetromino, targets[i], &rng);
+      }
+      env_step(env, gravity_only ? NULL : actions, &out);
+    }
+
+    for (size_t i = 0; i < envs && ok; i++) {
+      Game_State *g = &games[i];
+      size_t before = lines_of(g);
+      bool done = step != 0 && step != steps / 2 &&
+                  reference_step(g, actions[i]);
+      // A topped out game clears nothing on its last step
+      float reward = done ? 0 : (float)(lines_of(g) - before);
+      if (done) {
+        lines += before;
+        resets++;
+        episodes[i]++;
+        game_init(g, seeds[i] + episodes[i] * ENV_EPISODE_STRIDE);
+      }
+      if (out.dones[i] != done || out.rewards[i] != reward ||
+          !observation_matches(&out, i, g)) {
+        fprintf(stderr,
+                "Env %zu differs from game_step at step %llu, episode "
+                "%llu: done %d reward %g, expected %d %g\n",
+                i, (unsigned long long)step, (unsigned long long)episodes[i],
+                out.dones[i], out.rewards[i], done, reward);
+        ok = false;
+      }
+    }
+  }
+  if (ok) {
+    for (size_t i = 0; i < envs; i++) {
+      lines += lines_of(&games[i]);
+    }
+    printf("%llu envs, %llu steps match game_step, %llu lines, %llu "
+           "auto-resets\n",
+           (unsigned long long)envs, (unsigned long long)steps,
+           (unsigned long long)lines, (unsigned long long)resets);
+  }
+
+  env_destroy(env);
+  free(seeds);
+  free(episodes);
+  free(games);
+  free(targets);
+  free(actions);
+  free(out.boards);
+  free(out.pieces);
+  free(out.previews);
+  free(out.rewards);
+  free(out.dones);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,567 @@
+#include "game.h"
+#include <string.h>
+
+// TODO: Maybe fast down movement should be incremental, so that right after
+// tet is grounded it resets, and not affects the newly spawned tet
+
+// TODO: Maybe implement kick rotations (Check if rotation is possible if you
+// move the piece away from the wall) -- kinda didn't liked it
+
+#define ZOBRIST_SEED 0x7E7215ull
+
+uint64_t zobrist_cells[BOARD_ROWS][BOARD_WIDTH];
+uint64_t zobrist_states[TET_TYPE_COUNT][TET_MAX_STATES];
+uint64_t zobrist_xs[TET_MASK_X_COUNT];
+uint64_t zobrist_ys[BOARD_ROWS];
+uint64_t zobrist_bag[8];
+
+const Tet_Mask *tetromino_mask(int type, int state, int x) {
+  if (x < -TET_MASK_X_BIAS || x >= BOARD_WIDTH)
+    return NULL;
+  return &tet_masks[type][state][x + TET_MASK_X_BIAS];
+}
+
+bool tetromino_collides(const Row *board, int type, int state, int x, int y) {
+  const Tet_Mask *mask = tetromino_mask(type, state, x);
+  if (mask == NULL || !mask->fits || y + mask->top < 0 ||
+      y + mask->bottom >= BOARD_ROWS)
+    return true;
+  const Row *rows = &board[y + mask->top];
+  return (rows[0] & mask->rows[0]) | (rows[1] & mask->rows[1]) |
+         (rows[2] & mask->rows[2]) | (rows[3] & mask->rows[3]);
+}
+
+uint64_t board_add_tetromino(Row *board, Tetromino tetromino) {
+  const Tet_Mask *mask =
+      tetromino_mask(tetromino.type, tetromino.state, tetromino.pos.x);
+  const Cell *parts = tet_states[tetromino.type][tetromino.state];
+  Row *rows = &board[tetromino.pos.y + mask->top];
+  uint64_t hash = 0;
+  for (size_t i = 0; i < 4; i++) {
+    rows[i] |= mask->rows[i];
+    hash ^= zobrist_cells[tetromino.pos.y + parts[i].y]
+                         [tetromino.pos.x + parts[i].x];
+  }
+  return hash;
+}
+
+void init_zobrist(void) {
+  static bool initialized = false;
+  if (initialized)
+    return;
+
+  Rng rng;
+  rng_seed(&rng, ZOBRIST_SEED);
+  for (int y = 0; y < BOARD_ROWS; y++) {
+    for (int x = 0; x < BOARD_WIDTH; x++) {
+      zobrist_cells[y][x] = rng_next(&rng);
+    }
+    zobrist_ys[y] = rng_next(&rng);
+  }
+  for (int type = 0; type < TET_TYPE_COUNT; type++) {
+    for (int state = 0; state < TET_MAX_STATES; state++) {
+      zobrist_states[type][state] = rng_next(&rng);
+    }
+  }
+  for (int x = 0; x < TET_MASK_X_COUNT; x++) {
+    zobrist_xs[x] = rng_next(&rng);
+  }
+  for (size_t i = 0; i < 8; i++) {
+    zobrist_bag[i] = rng_next(&rng);
+  }
+  initialized = true;
+}
+
+uint64_t zobrist_row(int y, Row row) {
+  uint64_t hash = 0;
+  for (; row; row &= row - 1) {
+    hash ^= zobrist_cells[y][ROW_CTZ(row)];
+  }
+  return hash;
+}
+
+static uint64_t zobrist_rows(const Row *board, int count) {
+  uint64_t hash = 0;
+  for (int y = 0; y < count; y++) {
+    hash ^= zobrist_row(y, board[y]);
+  }
+  return hash;
+}
+
+uint64_t zobrist_board(const Row *board) {
+  return zobrist_rows(board, BOARD_ROWS);
+}
+
+uint64_t zobrist_tetromino(Tetromino tetromino) {
+  return zobrist_states[tetromino.type][tetromino.state] ^
+         zobrist_xs[tetromino.pos.x + TET_MASK_X_BIAS] ^
+         zobrist_ys[tetromino.pos.y];
+}
+
+static void set_tetromino(Game_State *g, Tetromino tetromino) {
+  g->hash ^= zobrist_tetromino(g->tetromino) ^ zobrist_tetromino(tetromino);
+  g->tetromino = tetromino;
+}
+
+static void move_tetromino(Game_State *g, Direction dir) {
+  Cell pos = g->tetromino.pos;
+  switch (dir) {
+  case Down:
+    pos.y++;
+    break;
+  case Left:
+    pos.x--;
+    break;
+  case Right:
+    pos.x++;
+    break;
+  }
+
+  if (!tetromino_collides(g->board, g->tetromino.type, g->tetromino.state,
+                          pos.x, pos.y)) {
+    Tetromino moved = g->tetromino;
+    moved.pos = pos;
+    set_tetromino(g, moved);
+  }
+}
+
+static void rotate_tetromino(Game_State *g) {
+  int new_state = tet_next_state[g->tetromino.type][g->tetromino.state];
+  if (!tetromino_collides(g->board, g->tetromino.type, new_state,
+                          g->tetromino.pos.x, g->tetromino.pos.y)) {
+    Tetromino rotated = g->tetromino;
+    rotated.state = new_state;
+    set_tetromino(g, rotated);
+  }
+}
+
+static bool tetromino_grounded(const Game_State *g) {
+  // On the ground or on the pile of dead tetrominos
+  return tetromino_collides(g->board, g->tetromino.type, g->tetromino.state,
+                            g->tetromino.pos.x, g->tetromino.pos.y + 1);
+}
+
+void shuffle_tetromino_types(uint8_t types[7], Rng *rng) {
+  uint8_t t;
+  int r;
+  for (size_t i = 0; i < 7; i++) {
+    types[i] = i;
+  }
+
+  for (size_t i = 6; i >= 1; i--) {
+    r = rng_below(rng, i + 1);
+    t = types[r];
+    types[r] = types[i];
+    types[i] = t;
+  }
+}
+
+static void refill_tetromino_bag(Game_State *g) {
+  uint8_t types[7];
+  shuffle_tetromino_types(types, &g->rng);
+  for (size_t i = 0; i < 7; i++) {
+    g->tetromino_bag[i] =
+        (Tetromino){.type = types[i], .state = 0, .pos = (Cell){0, 0}};
+  }
+  g->tetromino_bag_used = 0;
+}
+
+Tetromino game_next_tetromino(Game_State *g) {
+  if (g->tetromino_bag_used == 7) {
+    refill_tetromino_bag(g);
+  }
+  Tetromino next = g->tetromino_bag[g->tetromino_bag_used++];
+  next.pos.x = tet_spawn_x[next.type];
+  return next;
+}
+
+static void spawn_tetromino(Game_State *g) {
+  g->hash ^= zobrist_bag[g->tetromino_bag_used];
+  Tetromino next = game_next_tetromino(g);
+  g->hash ^= zobrist_bag[g->tetromino_bag_used];
+  set_tetromino(g, next);
+}
+
+static void level_up(Game_State *g) {
+  if (g->points >= (size_t)NEW_LEVEL_POINTS * g->level_num) {
+    g->gravity_ticks -= GRAVITY_TICKS_INC;
+    if (g->gravity_ticks < MIN_GRAVITY_TICKS)
+      g->gravity_ticks = MIN_GRAVITY_TICKS;
+    g->level_num++;
+  }
+}
+
+Column board_full_rows(const Row *board) {
+  Column rows = 0;
+  for (int y = BOARD_HEIGHT_EXTRA + 1; y < BOARD_ROWS; y++) {
+    rows |= (Column)(board[y] == FULL_ROW) << y;
+  }
+  return rows;
+}
+
+void board_clear_rows(Row *board, Column rows) {
+  if (rows == 0)
+    return;
+  // Everything below the lowest cleared row stays put
+  int write = COLUMN_BITS - 1 - COLUMN_CLZ(rows);
+  for (int y = write; y >= 0; y--) {
+    if (rows >> y & 1)
+      continue;
+    board[write--] = board[y];
+  }
+  while (write >= 0) {
+    board[write--] = 0;
+  }
+}
+
+static uint8_t row_transitions(Row row) {
+  // Neighbouring columns, then the walls on both sides
+  return ROW_POPCOUNT((Row)(row ^ row >> 1) & (FULL_ROW >> 1)) +
+         !(row & COLUMN_BIT(0)) + !(row & COLUMN_BIT(BOARD_WIDTH - 1));
+}
+
+static void metrics_update_column(Board_Metrics *m, int x) {
+  Column column = m->columns[x];
+  int height = column ? BOARD_ROWS - COLUMN_CTZ(column) : 0;
+  int holes = height - COLUMN_POPCOUNT(column);
+  m->aggregate_height += height - m->heights[x];
+  m->total_holes += holes - m->holes[x];
+  m->heights[x] = height;
+  m->holes[x] = holes;
+}
+
+static void metrics_update_well(Board_Metrics *m, int x) {
+  int left = x > 0 ? m->heights[x - 1] : BOARD_ROWS;
+  int right = x < BOARD_WIDTH - 1 ? m->heights[x + 1] : BOARD_ROWS;
+  int lower = left < right ? left : right;
+  int well = lower > m->heights[x] ? lower - m->heights[x] : 0;
+  m->total_wells += well - m->wells[x];
+  m->wells[x] = well;
+}
+
+void metrics_init(Board_Metrics *m, const Row *board) {
+  *m = (Board_Metrics){0};
+  for (int y = 0; y < BOARD_ROWS; y++) {
+    for (int x = 0; x < BOARD_WIDTH; x++) {
+      m->columns[x] |= (Column)((board[y] >> x) & 1) << y;
+    }
+    m->row_transitions[y] = row_transitions(board[y]);
+    m->total_row_transitions += m->row_transitions[y];
+  }
+  for (int x = 0; x < BOARD_WIDTH; x++) {
+    metrics_update_column(m, x);
+  }
+  for (int x = 0; x < BOARD_WIDTH; x++) {
+    metrics_update_well(m, x);
+  }
+}
+
+void metrics_add_tetromino(Board_Metrics *m, const Row *board,
+                           Tetromino tetromino) {
+  const Cell *parts = tet_states[tetromino.type][tetromino.state];
+  int min_x = BOARD_WIDTH, max_x = 0;
+  for (size_t i = 0; i < 4; i++) {
+    int x = tetromino.pos.x + parts[i].x;
+    int y = tetromino.pos.y + parts[i].y;
+    m->columns[x] |= (Column)1 << y;
+    min_x = x < min_x ? x : min_x;
+    max_x = x > max_x ? x : max_x;
+  }
+
+  const Tet_Mask *mask =
+      tetromino_mask(tetromino.type, tetromino.state, tetromino.pos.x);
+  for (int y = tetromino.pos.y + mask->top; y <= tetromino.pos.y + mask->bottom;
+       y++) {
+    uint8_t transitions = row_transitions(board[y]);
+    m->total_row_transitions += transitions - m->row_transitions[y];
+    m->row_transitions[y] = transitions;
+  }
+
+  for (int x = min_x; x <= max_x; x++) {
+    metrics_update_column(m, x);
+  }
+  // A column's well depth also depends on both neighbours
+  for (int x = min_x > 0 ? min_x - 1 : 0;
+       x <= (max_x < BOARD_WIDTH - 1 ? max_x + 1 : max_x); x++) {
+    metrics_update_well(m, x);
+  }
+}
+
+void metrics_clear_rows(Board_Metrics *m, const Row *board, Column rows) {
+  if (rows == 0)
+    return;
+  for (int x = 0; x < BOARD_WIDTH; x++) {
+    m->columns[x] = column_remove_rows(m->columns[x], rows);
+    metrics_update_column(m, x);
+  }
+  for (int x = 0; x < BOARD_WIDTH; x++) {
+    metrics_update_well(m, x);
+  }
+
+  // Only rows above the lowest cleared one moved
+  int lowest = COLUMN_BITS - 1 - COLUMN_CLZ(rows);
+  for (int y = 0; y <= lowest; y++) {
+    uint8_t transitions = row_transitions(board[y]);
+    m->total_row_transitions += transitions - m->row_transitions[y];
+    m->row_transitions[y] = transitions;
+  }
+}
+
+int tetromino_drop_distance(const Board_Metrics *m, Tetromino tetromino) {
+  const int8_t *bottoms = tet_bottoms[tetromino.type][tetromino.state];
+  int distance = BOARD_ROWS;
+  for (int dx = 0; dx < 4; dx++) {
+    if (bottoms[dx] == TET_NO_BOTTOM)
+      continue;
+    int bottom = tetromino.pos.y + bottoms[dx];
+    // First filled cell under the piece, or the floor
+    Column below =
+        m->columns[tetromino.pos.x + dx] & ~(((Column)2 << bottom) - 1);
+    int landing = below ? COLUMN_CTZ(below) : BOARD_ROWS;
+    if (landing - bottom - 1 < distance)
+      distance = landing - bottom - 1;
+  }
+  return distance;
+}
+
+static bool full_lines(Game_State *g) {
+  g->clear_rows = board_full_rows(g->board);
+  g->clear_animation = g->clear_rows != 0;
+  return g->clear_animation;
+}
+
+static void clear_full_lines(Game_State *g) {
+  // The animation may have left the rows blank, put them back the way they
+  // were hashed. Only rows down to the lowest cleared one move.
+  int lowest = COLUMN_BITS - 1 - COLUMN_CLZ(g->clear_rows);
+  for (int y = 0; y <= lowest; y++) {
+    if (g->clear_rows >> y & 1)
+      g->board[y] = FULL_ROW;
+  }
+  g->hash ^= zobrist_rows(g->board, lowest + 1);
+  board_clear_rows(g->board, g->clear_rows);
+  g->hash ^= zobrist_rows(g->board, lowest + 1);
+  metrics_clear_rows(&g->metrics, g->board, g->clear_rows);
+  g->points += COLUMN_POPCOUNT(g->clear_rows) * CLEAR_LINE_POINTS;
+  g->clear_rows = 0;
+
+  level_up(g);
+}
+
+static bool clear_animation_done(Game_State *g) {
+  if (!g->clear_animation)
+    return true;
+
+  g->clear_animation_time++;
+  g->clear_animation_switch_time++;
+
+  if (g->clear_animation_time >= CLEAR_ANIMATION_DURATION) {
+    g->clear_animation = false;
+    g->clear_animation_time = 0;
+    g->clear_animation_switch_time = 0;
+
+    clear_full_lines(g);
+    spawn_tetromino(g);
+    return true;
+  }
+
+  if (g->clear_rows != 0) {
+    for (int y = 0; y < BOARD_ROWS; y++) {
+      if (!(g->clear_rows >> y & 1))
+        continue;
+      g->board[y] =
+          g->clear_animation_switch_time >= CLEAR_ANIMATION_SWITCH_DURATION
+              ? FULL_ROW
+              : 0;
+    }
+    if (g->clear_animation_switch_time >= CLEAR_ANIMATION_SWITCH_DURATION) {
+      g->clear_animation_switch_time = 0;
+    }
+  }
+  return false;
+}
+
+static void game_over(Game_State *g) {
+  g->gravity_ticks = INIT_GRAVITY_TICKS;
+  g->level_num = 1;
+  g->points = 0;
+  g->game_over_animation = true;
+  // The sweep leaves the hidden rows, and the topped out tetromino in them
+  memset(g->board, 0, sizeof(g->board));
+  metrics_init(&g->metrics, g->board);
+  spawn_tetromino(g);
+  g->hash = game_hash(g);
+}
+
+static bool game_over_animation_done(Game_State *g) {
+  if (!g->game_over_animation)
+    return true;
+  int x, y;
+  g->game_over_animation_time++;
+  for (y = g->game_over_animation_y; y < BOARD_ROWS; y++) {
+    for (x = g->game_over_animation_x; x < BOARD_WIDTH; x++) {
+      if (g->game_over_animation_time * y < GAME_OVER_ANIMATION_CELL_TIME)
+        return false;
+      if (g->board[y] & COLUMN_BIT(x)) {
+        g->board[y] &= ~COLUMN_BIT(x);
+        g->hash ^= zobrist_cells[y][x];
+        g->game_over_animation_time = 0;
+        return false;
+      }
+    }
+  }
+  game_over(g);
+  g->game_over_animation = false;
+  return true;
+}
+
+void game_init(Game_State *g, uint64_t seed) {
+  init_zobrist();
+  *g = (Game_State){.level_num = 1, .gravity_ticks = INIT_GRAVITY_TICKS};
+  rng_seed(&g->rng, seed);
+  metrics_init(&g->metrics, g->board);
+  refill_tetromino_bag(g);
+  spawn_tetromino(g);
+  g->tetromino_prev = g->tetromino;
+  g->hash = game_hash(g);
+}
+
+uint64_t game_hash(const Game_State *g) {
+  uint64_t hash = zobrist_board(g->board);
+  if (g->clear_animation) {
+    for (int y = 0; y < BOARD_ROWS; y++) {
+      if (g->clear_rows >> y & 1)
+        hash ^= zobrist_row(y, g->board[y]) ^ zobrist_row(y, FULL_ROW);
+    }
+  }
+  return hash ^ zobrist_tetromino(g->tetromino) ^
+         zobrist_bag[g->tetromino_bag_used];
+}
+
+// Returns false when the locked tetromino topped out the board
+static bool lock_tetromino(Game_State *g) {
+  g->hash ^= board_add_tetromino(g->board, g->tetromino);
+  metrics_add_tetromino(&g->metrics, g->board, g->tetromino);
+
+  if (g->board[BOARD_HEIGHT_EXTRA]) {
+    g->game_over_animation = true;
+    g->game_over_animation_y = BOARD_HEIGHT_EXTRA;
+    g->game_over_animation_x = 0;
+    return false;
+  }
+
+  if (!full_lines(g)) {
+    spawn_tetromino(g);
+  }
+  return true;
+}
+
+int game_place(Game_State *g, Tetromino placement) {
+  set_tetromino(g, placement);
+  g->hash ^= board_add_tetromino(g->board, g->tetromino);
+  metrics_add_tetromino(&g->metrics, g->board, g->tetromino);
+  if (g->board[BOARD_HEIGHT_EXTRA])
+    return -1;
+
+  g->clear_rows = board_full_rows(g->board);
+  int lines = COLUMN_POPCOUNT(g->clear_rows);
+  if (lines)
+    clear_full_lines(g);
+  spawn_tetromino(g);
+  return lines;
+}
+
+bool game_add_garbage(Game_State *g, int hole) {
+  memmove(g->board, g->board + 1, (BOARD_ROWS - 1) * sizeof(Row));
+  g->board[BOARD_ROWS - 1] = FULL_ROW & ~COLUMN_BIT(hole);
+  metrics_init(&g->metrics, g->board);
+  g->hash = game_hash(g);
+  Tetromino t = g->tetromino;
+  return !g->board[BOARD_HEIGHT_EXTRA] &&
+         !tetromino_collides(g->board, t.type, t.state, t.pos.x, t.pos.y);
+}
+
+void game_step(Game_State *g, Game_Input input) {
+  g->ticks++;
+  g->tetromino_prev = g->tetromino;
+
+  if (g->last_tick_time >= g->gravity_ticks) {
+    g->last_tick_time = 0;
+    g->tick_time = true;
+  }
+  g->last_tick_time++;
+
+  if (!clear_animation_done(g)) {
+    return;
+  }
+  level_up(g);
+
+  if (!game_over_animation_done(g)) {
+    return;
+  }
+
+  if (g->tick_time) {
+    if (tetromino_grounded(g)) {
+      // A clear animation holds the locked tetromino until it's done
+      if (!lock_tetromino(g) || g->clear_animation) {
+        return;
+      }
+    } else {
+      move_tetromino(g, Down);
+      g->tick_time = false;
+      return;
+    }
+  }
+
+  if (input.hard_drop_pressed) {
+    Tetromino dropped = g->tetromino;
+    dropped.pos.y += tetromino_drop_distance(&g->metrics, g->tetromino);
+    set_tetromino(g, dropped);
+    lock_tetromino(g);
+    return;
+  }
+
+  if (input.rotate_pressed) {
+    rotate_tetromino(g);
+    return;
+  }
+
+  if (input.left_pressed) {
+    g->last_horizontal_tick = 0;
+    move_tetromino(g, Left);
+  }
+
+  if (input.right_pressed) {
+    g->last_horizontal_tick = 0;
+    move_tetromino(g, Right);
+  }
+
+  // Continuous press
+
+  // Both directions are pressed
+  if (input.left_down && input.right_down) {
+    g->last_horizontal_tick = 0;
+  }
+
+  if (input.left_down) {
+    g->last_horizontal_tick++;
+
+    if (g->last_horizontal_tick >= FAST_TICK_HORIZONTAL) {
+      g->last_horizontal_tick = 0;
+      move_tetromino(g, Left);
+    }
+  }
+
+  if (input.right_down) {
+    g->last_horizontal_tick++;
+
+    if (g->last_horizontal_tick >= FAST_TICK_HORIZONTAL) {
+      g->last_horizontal_tick = 0;
+      move_tetromino(g, Right);
+    }
+  }
+
+  if (input.fast_down) {
+    g->last_tick_time += FAST_TICK_VERTICAL;
+  }
+}
@@ -0,0 +1,306 @@
+#ifndef GAME_H_
+#define GAME_H_
+
+// Game rules without any window, input or drawing dependencies. The windowed
+// client in main.c and headless tools drive a Game_State through game_step,
+// which advances the simulation by exactly one fixed tick. All timers count
+// ticks, so the same inputs always produce the same game.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Tet_Type and the table sizes, generated by src/gen_tables.c
+#include "tet_tables.h"
+
+// The board size is fixed at compile time so rows and columns pack into the
+// smallest integers that hold them. Override with -DBOARD_WIDTH=... etc, the
+// game core and every file including this header must agree.
+#ifndef BOARD_WIDTH
+#define BOARD_WIDTH 10
+#endif
+#ifndef BOARD_HEIGHT
+#define BOARD_HEIGHT 20
+#endif
+#ifndef BOARD_HEIGHT_EXTRA
+#define BOARD_HEIGHT_EXTRA 2
+#endif
+#define BOARD_ROWS (BOARD_HEIGHT + BOARD_HEIGHT_EXTRA)
+
+#if TET_TABLES_BOARD_WIDTH != BOARD_WIDTH
+#error "tet_tables.h was generated for another BOARD_WIDTH, rerun nob"
+#endif
+
+#if BOARD_WIDTH < 4 || BOARD_WIDTH > 64
+#error "BOARD_WIDTH must be between 4 and 64"
+#endif
+#if BOARD_HEIGHT < 4 || BOARD_HEIGHT_EXTRA < 1 || BOARD_ROWS > 64
+#error "BOARD_HEIGHT + BOARD_HEIGHT_EXTRA must fit in 64 rows"
+#endif
+#define GAME_TICKS_PER_SECOND 60
+#define GAME_TICK_SECONDS (1.0f / GAME_TICKS_PER_SECOND)
+// Ticks between gravity steps, .8s at the first level and .05s less per level
+#define INIT_GRAVITY_TICKS 48
+#define GRAVITY_TICKS_INC 3
+#define MIN_GRAVITY_TICKS 1
+#define FAST_TICK_HORIZONTAL 6
+#define FAST_TICK_VERTICAL 15
+
+#define NEW_LEVEL_POINTS 50
+#define CLEAR_LINE_POINTS 10
+#define CLEAR_ANIMATION_DURATION 18
+#define CLEAR_ANIMATION_SWITCH_DURATION (CLEAR_ANIMATION_DURATION / 3)
+
+// A cell in row y disappears once ticks * y reaches this
+#define GAME_OVER_ANIMATION_CELL_TIME 5
+
+typedef struct {
+  int8_t x, y;
+} Cell;
+
+typedef Cell Parts[4];
+
+// One bit per column, bit x is column x. Rows are indexed top to bottom, the
+// first BOARD_HEIGHT_EXTRA rows are hidden above the visible field.
+#if BOARD_WIDTH <= 16
+typedef uint16_t Row;
+#define ROW_BITS 16
+#define ROW_CTZ(row) __builtin_ctz(row)
+#define ROW_POPCOUNT(row) __builtin_popcount(row)
+#elif BOARD_WIDTH <= 32
+typedef uint32_t Row;
+#define ROW_BITS 32
+#define ROW_CTZ(row) __builtin_ctz(row)
+#define ROW_POPCOUNT(row) __builtin_popcount(row)
+#else
+typedef uint64_t Row;
+#define ROW_BITS 64
+#define ROW_CTZ(row) __builtin_ctzll(row)
+#define ROW_POPCOUNT(row) __builtin_popcountll(row)
+#endif
+// Shifting 2 keeps a 64 column row from shifting by its own width
+#define FULL_ROW ((Row)(((Row)2 << (BOARD_WIDTH - 1)) - 1))
+#define COLUMN_BIT(x) ((Row)((Row)1 << (x)))
+
+typedef enum { Down, Left, Right } Direction;
+
+// Cells of the parts relative to pos, inclusive
+typedef struct {
+  int8_t left, right, top, bottom;
+} Tet_Box;
+
+// Row masks of one piece state placed at one column offset. rows[0] is the
+// piece's topmost row, which sits top rows below pos.y; rows past the piece's
+// height are empty.
+typedef struct {
+  Row rows[4];
+  int8_t top, bottom;
+  bool fits;
+} Tet_Mask;
+
+// All generated into tet_tables.c and indexed [type][state], states past
+// tet_state_count are empty. Rotating goes to tet_next_state.
+extern const uint8_t tet_state_count[TET_TYPE_COUNT];
+extern const uint8_t tet_next_state[TET_TYPE_COUNT][TET_MAX_STATES];
+extern const int8_t tet_spawn_x[TET_TYPE_COUNT];
+extern const Parts tet_states[TET_TYPE_COUNT][TET_MAX_STATES];
+extern const Tet_Box tet_boxes[TET_TYPE_COUNT][TET_MAX_STATES];
+extern const Tet_Mask tet_masks[TET_TYPE_COUNT][TET_MAX_STATES]
+                               [TET_MASK_X_COUNT];
+// Lowest dy of each state in each of its columns dx, TET_NO_BOTTOM where the
+// state has no cell in that column
+#define TET_NO_BOTTOM INT8_MIN
+extern const int8_t tet_bottoms[TET_TYPE_COUNT][TET_MAX_STATES][4];
+
+typedef struct {
+  Cell pos;
+  uint8_t type; // Tet_Type
+  uint8_t state;
+} Tetromino;
+
+// Zobrist keys, filled by init_zobrist() from a fixed seed so a state hashes
+// the same in every run. A tetromino is keyed by state, x and y separately.
+extern uint64_t zobrist_cells[BOARD_ROWS][BOARD_WIDTH];
+extern uint64_t zobrist_states[TET_TYPE_COUNT][TET_MAX_STATES];
+extern uint64_t zobrist_xs[TET_MASK_X_COUNT];
+extern uint64_t zobrist_ys[BOARD_ROWS];
+// Indexed by tetromino_bag_used
+extern uint64_t zobrist_bag[8];
+
+// Bit y is set when the cell in row y of a column is filled. Sets of rows,
+// like the full rows to clear, use the same type.
+#if BOARD_ROWS <= 32
+typedef uint32_t Column;
+#define COLUMN_BITS 32
+#define COLUMN_CTZ(column) __builtin_ctz(column)
+#define COLUMN_CLZ(column) __builtin_clz(column)
+#define COLUMN_POPCOUNT(column) __builtin_popcount(column)
+#else
+typedef uint64_t Column;
+#define COLUMN_BITS 64
+#define COLUMN_CTZ(column) __builtin_ctzll(column)
+#define COLUMN_CLZ(column) __builtin_clzll(column)
+#define COLUMN_POPCOUNT(column) __builtin_popcountll(column)
+#endif
+
+// The column after the given rows were cleared and the cells above them fell
+static inline Column column_remove_rows(Column column, Column rows) {
+  // Going top down keeps the indices of the rows still to remove valid
+  for (; rows; rows &= rows - 1) {
+    int y = COLUMN_CTZ(rows);
+    Column above = column & (((Column)1 << y) - 1);
+    Column below = column & ~(((Column)2 << y) - 1);
+    column = above << 1 | below;
+  }
+  return column;
+}
+
+// Surface numbers of the locked board, kept up to date as pieces lock and
+// rows clear so callers never have to scan the board for them.
+typedef struct {
+  Column columns[BOARD_WIDTH];
+  // Rows from the bottom up to and including the column's top cell
+  uint8_t heights[BOARD_WIDTH];
+  // Empty cells below the column's top cell
+  uint8_t holes[BOARD_WIDTH];
+  // How far the column sits below its lower neighbour, walls are infinitely
+  // high
+  uint8_t wells[BOARD_WIDTH];
+  // Filled/empty changes along the row, the walls count as filled
+  uint8_t row_transitions[BOARD_ROWS];
+
+  int aggregate_height;
+  int total_holes;
+  int total_wells;
+  int total_row_transitions;
+} Board_Metrics;
+
+// xoshiro256** generator. Every game owns one, so a seed fully determines
+// the piece sequence and games never share state across threads.
+typedef struct {
+  uint64_t s[4];
+} Rng;
+
+static inline uint64_t rng_rotl(uint64_t x, int k) {
+  return (x << k) | (x >> (64 - k));
+}
+
+static inline void rng_seed(Rng *rng, uint64_t seed) {
+  // splitmix64 spreads even small consecutive seeds over the whole state
+  for (size_t i = 0; i < 4; i++) {
+    uint64_t z = (seed += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    rng->s[i] = z ^ (z >> 31);
+  }
+}
+
+static inline uint64_t rng_next(Rng *rng) {
+  uint64_t *s = rng->s;
+  uint64_t result = rng_rotl(s[1] * 5, 7) * 9;
+  uint64_t t = s[1] << 17;
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = rng_rotl(s[3], 45);
+  return result;
+}
+
+// Uniform in [0, n) for the small n the game needs
+static inline uint32_t rng_below(Rng *rng, uint32_t n) {
+  return (uint32_t)(((rng_next(rng) >> 32) * n) >> 32);
+}
+
+// What the player did since the previous tick. The *_pressed fields are
+// edges, the *_down fields are held keys.
+typedef struct {
+  bool rotate_pressed;
+  bool left_pressed;
+  bool right_pressed;
+  bool left_down;
+  bool right_down;
+  bool fast_down;
+  bool hard_drop_pressed;
+} Game_Input;
+
+typedef struct {
+  // Padded so a piece mask can always read 4 rows below its top row.
+  Row board[BOARD_ROWS + 3];
+  // The falling tetromino is not part of the board until it locks.
+  Tetromino tetromino;
+  // The tetromino as it was before the last tick, for render interpolation.
+  Tetromino tetromino_prev;
+  Tetromino tetromino_bag[7];
+  int tetromino_bag_used;
+  Rng rng;
+  Board_Metrics metrics;
+  // Zobrist hash of the locked board, the falling tetromino and the bag
+  // position, see game_hash(). The blinking rows of the clear animation are
+  // hashed as the full rows they were at lock time.
+  uint64_t hash;
+
+  uint64_t ticks;
+  int level_num;
+  int gravity_ticks;
+  size_t points;
+
+  int last_tick_time;
+  bool tick_time;
+  int last_horizontal_tick;
+
+  bool clear_animation;
+  // Bit y is set for every full row waiting to be cleared
+  Column clear_rows;
+  int clear_animation_time;
+  int clear_animation_switch_time;
+
+  bool game_over_animation;
+  int game_over_animation_time;
+  int game_over_animation_x;
+  int game_over_animation_y;
+} Game_State;
+
+const Tet_Mask *tetromino_mask(int type, int state, int x);
+bool tetromino_collides(const Row *board, int type, int state, int x, int y);
+// Returns the Zobrist hash of the cells it filled
+uint64_t board_add_tetromino(Row *board, Tetromino tetromino);
+// Bit y of the result is set for every full row below the hidden rows
+Column board_full_rows(const Row *board);
+// Removes the given rows and drops everything above them, in one pass
+void board_clear_rows(Row *board, Column rows);
+// Rows the tetromino can fall before it lands, read straight off the column
+// bitboards. Also gives the ghost piece at pos.y + the distance.
+int tetromino_drop_distance(const Board_Metrics *m, Tetromino tetromino);
+void metrics_init(Board_Metrics *m, const Row *board);
+// Call after the tetromino was added to board
+void metrics_add_tetromino(Board_Metrics *m, const Row *board,
+                           Tetromino tetromino);
+// Call after rows were cleared from board
+void metrics_clear_rows(Board_Metrics *m, const Row *board, Column rows);
+void init_zobrist(void);
+uint64_t zobrist_row(int y, Row row);
+uint64_t zobrist_board(const Row *board);
+uint64_t zobrist_tetromino(Tetromino tetromino);
+// Fills types with the 7 Tet_Types in a random order, one 7-bag
+void shuffle_tetromino_types(uint8_t types[7], Rng *rng);
+
+void game_init(Game_State *g, uint64_t seed);
+void game_step(Game_State *g, Game_Input input);
+// Takes the next tetromino from the bag at its spawn position, refilling the
+// bag when it's empty. Doesn't touch g->tetromino or g->hash.
+Tetromino game_next_tetromino(Game_State *g);
+// Locks placement straight away, without gravity or the animations: clears
+// the full rows, scores them like game_step and spawns the next tetromino.
+// Returns the rows cleared, or -1 when the placement topped out, leaving
+// the board with the piece in the hidden rows.
+int game_place(Game_State *g, Tetromino placement);
+// Pushes the board up a row and fills the new bottom row except for column
+// hole, like the garbage of versus games. Returns false when that tops out:
+// a cell reaches the top visible row or the falling tetromino.
+bool game_add_garbage(Game_State *g, int hole);
+// Hashes the state from scratch, game_step keeps g->hash equal to this
+uint64_t game_hash(const Game_State *g);
+
+#endif // GAME_H_
@@ -0,0 +1,286 @@
+// Generates build/tet_tables.h and build/tet_tables.c from the piece
+// descriptions below: every rotation state, its bounding box, the spawn
+// columns and the collision masks for each column. nob builds and runs this
+// before the game core, with the same -DBOARD_* flags.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Same default as game.h, which refuses tables made for another width
+#ifndef BOARD_WIDTH
+#define BOARD_WIDTH 10
+#endif
+
+#define MAX_STATES 4
+// Parts can start up to 3 columns right of pos, so pos.x may go negative.
+#define MASK_X_BIAS 3
+#define MASK_X_COUNT (BOARD_WIDTH + MASK_X_BIAS)
+
+typedef struct {
+  int x, y;
+} Cell;
+
+typedef struct {
+  const char *name;
+  // The spawn state, relative to the tetromino's pos
+  Cell cells[4];
+  // Rotation centre in half cells, so it can sit on a cell corner
+  Cell pivot2;
+} Piece;
+
+// In Tet_Type order, which is also the order a fresh bag is shuffled from.
+// TODO: make them all horizontal so that they take only 2 vertical cells
+static const Piece pieces[] = {
+    {"I", {{0, 0}, {1, 0}, {2, 0}, {3, 0}}, {3, 1}},
+    {"L", {{0, 1}, {1, 1}, {2, 1}, {2, 0}}, {2, 2}},
+    {"J", {{0, 0}, {0, 1}, {1, 1}, {2, 1}}, {2, 2}},
+    {"T", {{0, 1}, {1, 1}, {2, 1}, {1, 2}}, {2, 2}},
+    {"S", {{1, 0}, {2, 0}, {1, 1}, {0, 1}}, {2, 0}},
+    {"Z", {{0, 0}, {1, 0}, {1, 1}, {2, 1}}, {2, 0}},
+    {"O", {{0, 0}, {1, 0}, {0, 1}, {1, 1}}, {1, 1}},
+};
+#define PIECE_COUNT (sizeof(pieces) / sizeof(pieces[0]))
+
+typedef struct {
+  Cell cells[MAX_STATES][4];
+  int state_count;
+  int left[MAX_STATES], right[MAX_STATES];
+  int top[MAX_STATES], bottom[MAX_STATES];
+  int spawn_x;
+} Piece_Tables;
+
+static Piece_Tables tables[PIECE_COUNT];
+
+// (x, y) goes to (pivot.x + dy, pivot.y - dx), the way the game always
+// rotated
+static Cell rotate_cell(Cell cell, Cell pivot2) {
+  int dx = 2 * cell.x - pivot2.x;
+  int dy = 2 * cell.y - pivot2.y;
+  return (Cell){(pivot2.x + dy) / 2, (pivot2.y - dx) / 2};
+}
+
+static bool has_cell(const Cell cells[4], int x, int y) {
+  for (size_t i = 0; i < 4; i++) {
+    if (cells[i].x == x && cells[i].y == y)
+      return true;
+  }
+  return false;
+}
+
+// Same cells up to a translation, so rotating further only moves the piece
+static bool same_shape(const Cell a[4], const Cell b[4]) {
+  int ax = a[0].x, ay = a[0].y, bx = b[0].x, by = b[0].y;
+  for (size_t i = 1; i < 4; i++) {
+    ax = a[i].x < ax ? a[i].x : ax;
+    ay = a[i].y < ay ? a[i].y : ay;
+    bx = b[i].x < bx ? b[i].x : bx;
+    by = b[i].y < by ? b[i].y : by;
+  }
+  for (size_t i = 0; i < 4; i++) {
+    if (!has_cell(b, a[i].x - ax + bx, a[i].y - ay + by))
+      return false;
+  }
+  return true;
+}
+
+static bool build_tables(void) {
+  for (size_t p = 0; p < PIECE_COUNT; p++) {
+    const Piece *piece = &pieces[p];
+    Piece_Tables *t = &tables[p];
+    if ((piece->pivot2.x ^ piece->pivot2.y) & 1) {
+      fprintf(stderr, "%s: pivot must be on a cell centre or a corner\n",
+              piece->name);
+      return false;
+    }
+
+    memcpy(t->cells[0], piece->cells, sizeof(t->cells[0]));
+    t->state_count = 1;
+    while (t->state_count < MAX_STATES) {
+      Cell next[4];
+      for (size_t i = 0; i < 4; i++) {
+        next[i] = rotate_cell(t->cells[t->state_count - 1][i], piece->pivot2);
+      }
+      if (same_shape(next, t->cells[0]))
+        break;
+      memcpy(t->cells[t->state_count++], next, sizeof(next));
+    }
+
+    int width = 0;
+    for (int s = 0; s < t->state_count; s++) {
+      const Cell *cells = t->cells[s];
+      t->left[s] = t->right[s] = cells[0].x;
+      t->top[s] = t->bottom[s] = cells[0].y;
+      for (size_t i = 1; i < 4; i++) {
+        t->left[s] = cells[i].x < t->left[s] ? cells[i].x : t->left[s];
+        t->right[s] = cells[i].x > t->right[s] ? cells[i].x : t->right[s];
+        t->top[s] = cells[i].y < t->top[s] ? cells[i].y : t->top[s];
+        t->bottom[s] = cells[i].y > t->bottom[s] ? cells[i].y : t->bottom[s];
+      }
+      if (t->left[s] < 0 || t->right[s] >= MASK_X_BIAS + 1 ||
+          t->bottom[s] - t->top[s] >= 4) {
+        fprintf(stderr, "%s: state %d doesn't fit the 4x4 masks\n",
+                piece->name, s);
+        return false;
+      }
+      width = t->right[s] + 1 > width ? t->right[s] + 1 : width;
+    }
+    t->spawn_x = (BOARD_WIDTH - width) / 2;
+  }
+  return true;
+}
+
+static void write_header(FILE *f) {
+  fprintf(f, "// Generated by src/gen_tables.c, do not edit.\n\n");
+  fprintf(f, "#ifndef TET_TABLES_H_\n#define TET_TABLES_H_\n\n");
+  fprintf(f, "#define TET_TABLES_BOARD_WIDTH %d\n", BOARD_WIDTH);
+  fprintf(f, "#define TET_TYPE_COUNT %zu\n", PIECE_COUNT);
+  fprintf(f, "#define TET_MAX_STATES %d\n", MAX_STATES);
+  fprintf(f, "#define TET_MASK_X_BIAS %d\n", MASK_X_BIAS);
+  fprintf(f, "#define TET_MASK_X_COUNT (BOARD_WIDTH + TET_MASK_X_BIAS)\n\n");
+  fprintf(f, "// One letter per Tet_Type\n#define TET_TYPE_NAMES \"");
+  for (size_t p = 0; p < PIECE_COUNT; p++) {
+    fprintf(f, "%s", pieces[p].name);
+  }
+  fprintf(f, "\"\n\n");
+  fprintf(f, "typedef enum {\n");
+  for (size_t p = 0; p < PIECE_COUNT; p++) {
+    fprintf(f, "  %s,\n", pieces[p].name);
+  }
+  fprintf(f, "} Tet_Type;\n\n#endif // TET_TABLES_H_\n");
+}
+
+static void write_source(FILE *f) {
+  fprintf(f, "// Generated by src/gen_tables.c, do not edit.\n\n");
+  fprintf(f, "#include \"game.h\"\n\n");
+
+  fprintf(f, "const uint8_t tet_state_count[TET_TYPE_COUNT] = {");
+  for (size_t p = 0; p < PIECE_COUNT; p++) {
+    fprintf(f, "%s%d", p ? ", " : "", tables[p].state_count);
+  }
+  fprintf(f, "};\n\n");
+
+  fprintf(f, "const int8_t tet_spawn_x[TET_TYPE_COUNT] = {");
+  for (size_t p = 0; p < PIECE_COUNT; p++) {
+    fprintf(f, "%s%d", p ? ", " : "", tables[p].spawn_x);
+  }
+  fprintf(f, "};\n\n");
+
+  fprintf(f, "const uint8_t tet_next_state[TET_TYPE_COUNT][TET_MAX_STATES] = "
+             "{\n");
+  for (size_t p = 0; p < PIECE_COUNT; p++) {
+    fprintf(f, "    [%s] = {", pieces[p].name);
+    for (int s = 0; s < tables[p].state_count; s++) {
+      fprintf(f, "%s%d", s ? ", " : "", (s + 1) % tables[p].state_count);
+    }
+    fprintf(f, "},\n");
+  }
+  fprintf(f, "};\n\n");
+
+  fprintf(f, "const Parts tet_states[TET_TYPE_COUNT][TET_MAX_STATES] = {\n");
+  for (size_t p = 0; p < PIECE_COUNT; p++) {
+    fprintf(f, "    [%s] = {\n", pieces[p].name);
+    for (int s = 0; s < tables[p].state_count; s++) {
+      const Cell *cells = tables[p].cells[s];
+      fprintf(f, "        {{%d, %d}, {%d, %d}, {%d, %d}, {%d, %d}},\n",
+              cells[0].x, cells[0].y, cells[1].x, cells[1].y, cells[2].x,
+              cells[2].y, cells[3].x, cells[3].y);
+    }
+    fprintf(f, "    },\n");
+  }
+  fprintf(f, "};\n\n");
+
+  fprintf(f, "const Tet_Box tet_boxes[TET_TYPE_COUNT][TET_MAX_STATES] = {\n");
+  for (size_t p = 0; p < PIECE_COUNT; p++) {
+    const Piece_Tables *t = &tables[p];
+    fprintf(f, "    [%s] = {", pieces[p].name);
+    for (int s = 0; s < t->state_count; s++) {
+      fprintf(f, "%s{%d, %d, %d, %d}", s ? ", " : "", t->left[s], t->right[s],
+              t->top[s], t->bottom[s]);
+    }
+    fprintf(f, "},\n");
+  }
+  fprintf(f, "};\n\n");
+
+  fprintf(f, "const int8_t tet_bottoms[TET_TYPE_COUNT][TET_MAX_STATES][4] = "
+             "{\n");
+  for (size_t p = 0; p < PIECE_COUNT; p++) {
+    fprintf(f, "    [%s] = {", pieces[p].name);
+    for (int s = 0; s < tables[p].state_count; s++) {
+      const Cell *cells = tables[p].cells[s];
+      fprintf(f, "%s{", s ? ", " : "");
+      for (int dx = 0; dx < 4; dx++) {
+        int bottom = INT8_MIN;
+        for (size_t i = 0; i < 4; i++) {
+          if (cells[i].x == dx && cells[i].y > bottom)
+            bottom = cells[i].y;
+        }
+        if (bottom == INT8_MIN)
+          fprintf(f, "%sTET_NO_BOTTOM", dx ? ", " : "");
+        else
+          fprintf(f, "%s%d", dx ? ", " : "", bottom);
+      }
+      fprintf(f, "}");
+    }
+    fprintf(f, "},\n");
+  }
+  fprintf(f, "};\n\n");
+
+  fprintf(f, "const Tet_Mask "
+             "tet_masks[TET_TYPE_COUNT][TET_MAX_STATES][TET_MASK_X_COUNT] = "
+             "{\n");
+  for (size_t p = 0; p < PIECE_COUNT; p++) {
+    const Piece_Tables *t = &tables[p];
+    fprintf(f, "    [%s] = {\n", pieces[p].name);
+    for (int s = 0; s < t->state_count; s++) {
+      fprintf(f, "        {\n");
+      for (int x = -MASK_X_BIAS; x < BOARD_WIDTH; x++) {
+        if (x + t->left[s] < 0 || x + t->right[s] >= BOARD_WIDTH) {
+          fprintf(f, "            {.top = %d, .bottom = %d},\n", t->top[s],
+                  t->bottom[s]);
+          continue;
+        }
+        uint64_t rows[4] = {0};
+        for (size_t i = 0; i < 4; i++) {
+          const Cell cell = t->cells[s][i];
+          rows[cell.y - t->top[s]] |= (uint64_t)1 << (x + cell.x);
+        }
+        fprintf(f,
+                "            {.rows = {0x%llx, 0x%llx, 0x%llx, 0x%llx}, "
+                ".top = %d, .bottom = %d, .fits = true},\n",
+                (unsigned long long)rows[0], (unsigned long long)rows[1],
+                (unsigned long long)rows[2], (unsigned long long)rows[3],
+                t->top[s], t->bottom[s]);
+      }
+      fprintf(f, "        },\n");
+    }
+    fprintf(f, "    },\n");
+  }
+  fprintf(f, "};\n");
+}
+
+static bool write_file(const char *dir, const char *name,
+                       void (*write)(FILE *f)) {
+  char path[1024];
+  snprintf(path, sizeof(path), "%s%s", dir, name);
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    fprintf(stderr, "Could not open %s\n", path);
+    return false;
+  }
+  write(f);
+  fclose(f);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  const char *dir = argc > 1 ? argv[1] : "build/";
+  if (!build_tables())
+    return 1;
+  if (!write_file(dir, "tet_tables.h", write_header) ||
+      !write_file(dir, "tet_tables.c", write_source))
+    return 1;
+  return 0;
+}
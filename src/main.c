@@ -1,8 +1,12 @@
+#include "bot.h"
+#include "game.h"
 #include "raylib.h"
 #include "raymath.h"
-#include <assert.h>
+#include "search.h"
+#include "tt.h"
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,107 +20,19 @@
 #include <emscripten/emscripten.h>
 #endif
 
-// TODO: Maybe fast down movement should be incremental, so that right after
-// tet is grounded it resets, and not affects the newly spawned tet
-
 // TODO: In touch screen fast down move sometimes stops
-// TODO: Maybe implement kick rotations (Check if rotation is possible if you
-// move the piece away from the wall) -- kinda didn't liked it
 
 // TODO: Pouse menu
-// TODO: Why after game over tetromino is so low?
 // TODO: Sound?
 
-#define BOARD_WIDTH 10
-#define BOARD_HEIGHT 20
-#define BOARD_HEIGHT_EXTRA 2
 #define CELL_WIDTH_RATIO 0.05f
 #define CELL_PADDING 120.0f * CELL_WIDTH_RATIO
-#define INIT_TICK 0.8f
-#define TICK_INC 0.05
-#define FAST_TICK_HORIZONTAL .09f
-#define FAST_TICK_VERTICAL 15.0f
 #define SINGLE_TAP_DELAY 0.15f
-
-#define NEW_LEVEL_POINTS 50
-#define CLEAR_LINE_POINTS 10
-#define CLEAR_ANIMATION_DURATION .3f
-#define CLEAR_ANIMATION_SWITCH_DURATION CLEAR_ANIMATION_DURATION / 3.0f
-
-#define GAME_OVER_ANIMATION_CELL_TIME .07f
-
-#define TET_I_STATES 2
-#define TET_L_STATES 4
-#define TET_J_STATES 4
-#define TET_T_STATES 4
-#define TET_S_STATES 2
-#define TET_Z_STATES 2
-#define TET_O_STATES 0
-
-typedef Vector2 Parts[4];
-
-typedef enum { Down, Left, Right } Direction;
-
-typedef enum {
-  I = 0,
-  L = I + TET_I_STATES, // 2
-  J = L + TET_L_STATES, // 6
-  T = J + TET_J_STATES, // 10
-  S = T + TET_T_STATES, // 14
-  Z = S + TET_S_STATES, // 16
-  O = Z + TET_Z_STATES, // 18
-} Tet_Type;
-
-int tetromino_types[] = {I, L, J, T, S, Z, O};
-
-int tet_max_widths[] = {
-    [I] = 4, [L] = 3, [J] = 3, [T] = 3, [S] = 3, [Z] = 3, [O] = 2};
-
-int tet_state_count[] = {
-    [I] = TET_I_STATES, [L] = TET_L_STATES, [J] = TET_J_STATES,
-    [T] = TET_T_STATES, [S] = TET_S_STATES, [Z] = TET_Z_STATES,
-    [O] = TET_O_STATES};
-
-#define TET_START_OFFSET BOARD_WIDTH / 2.0f
-// TODO: make them all horizontal so that they take only 2 vertical cells
-Parts tet_states[O + 1] = {
-    (Vector2){0, 0},  (Vector2){1, 0}, (Vector2){2, 0}, (Vector2){3, 0}, // I
-    (Vector2){1, -1}, (Vector2){1, 0}, (Vector2){1, 1}, (Vector2){1, 2},
-
-    (Vector2){0, 1},  (Vector2){1, 1}, (Vector2){2, 1}, (Vector2){2, 0},
-    (Vector2){0, 0},  (Vector2){1, 0}, (Vector2){1, 1}, (Vector2){1, 2},
-    (Vector2){0, 2},  (Vector2){0, 1}, (Vector2){1, 1}, (Vector2){2, 1},
-    (Vector2){1, 0},  (Vector2){1, 1}, (Vector2){1, 2}, (Vector2){2, 2}, // L
-
-    (Vector2){0, 0},  (Vector2){0, 1}, (Vector2){1, 1}, (Vector2){2, 1}, // J
-    (Vector2){1, 0},  (Vector2){1, 1}, (Vector2){1, 2}, (Vector2){0, 2},
-    (Vector2){0, 1},  (Vector2){1, 1}, (Vector2){2, 1}, (Vector2){2, 2},
-    (Vector2){1, 0},  (Vector2){2, 0}, (Vector2){1, 1}, (Vector2){1, 2},
-
-    (Vector2){0, 1},  (Vector2){1, 1}, (Vector2){2, 1}, (Vector2){1, 2}, // T
-    (Vector2){1, 0},  (Vector2){1, 1}, (Vector2){1, 2}, (Vector2){2, 1},
-    (Vector2){1, 0},  (Vector2){0, 1}, (Vector2){1, 1}, (Vector2){2, 1},
-    (Vector2){1, 0},  (Vector2){1, 1}, (Vector2){1, 2}, (Vector2){0, 1},
-
-    (Vector2){1, 0},  (Vector2){2, 0}, (Vector2){1, 1}, (Vector2){0, 1}, // S
-    (Vector2){1, -1}, (Vector2){1, 0}, (Vector2){2, 0}, (Vector2){2, 1},
-
-    (Vector2){0, 0},  (Vector2){1, 0}, (Vector2){1, 1}, (Vector2){2, 1}, // Z
-    (Vector2){2, -1}, (Vector2){1, 0}, (Vector2){1, 1}, (Vector2){2, 0},
-
-    (Vector2){0, 0},  (Vector2){1, 0}, (Vector2){0, 1}, (Vector2){1, 1}, // O
-};
-
-typedef struct {
-  Vector2 pos;
-  Parts parts;
-  Tet_Type type;
-  int state;
-} Tetromino;
+// Longest frame the simulation catches up on, so a stall doesn't freeze it
+#define MAX_FRAME_TIME 0.25f
+#define GHOST_ALPHA 0.3f
 
 typedef struct {
-  int score_points;
-  float tick;
   Color empty_cell_color;
   Color alive_cell_color;
   Color background_color;
@@ -139,9 +55,27 @@ Color background_colors[] = {
     {0x7B, 0x90, 0x4B, 0xFF}, {0xA0, 0x6D, 0x26, 0xFF},
     {0xC4, 0x49, 0x00, 0xFF}, {0x43, 0x25, 0x34, 0xFF}};
 
-bool board[BOARD_WIDTH][BOARD_HEIGHT + BOARD_HEIGHT_EXTRA] = {0};
-Tetromino tetromino_bag[7] = {0};
-int tetromino_bag_used = 0;
+Game_State game;
+// Edges seen since the last tick, kept until a tick consumes them
+Game_Input pending_input;
+float tick_accumulator = 0;
+// Level colours only, kept apart from the game's own piece generator
+Rng level_rng;
+
+// P toggles the bot, -autoplay starts with it on
+bool autoplay = false;
+// Every core the machine has, for the bot
+static Pool pool;
+// Looks ahead through the bag, the greedy bot stands in if it can't start
+static Search search;
+static bool search_ready = false;
+// Remembers the search's decisions from one piece to the next, optional
+static Tt tt;
+static bool tt_ready = false;
+static Bot bot;
+// Where the bot is taking the current piece, planned when it spawned
+Tetromino autoplay_target;
+int autoplay_planned_bag_used = -1;
 
 static int screen_width;
 static int screen_height;
@@ -156,343 +90,108 @@ Vector2 touch_pos[2];
 int gesture;
 int touch_points_count;
 
-float last_tick_time = 0;
 float delta_time = 0;
-bool tick_time = 0;
 float current_time = 0;
 float last_tap_time = 0;
 
-bool clear_animation = false;
-int clear_lowest_y = 0;
-int clear_shift_amount = 0;
-float clear_animation_time = 0;
-float clear_animation_switch_time = 0;
-
-bool game_over_animation = false;
-float game_over_animation_time = 0;
-int game_over_animation_x;
-int game_over_animation_y;
-
-float last_horizontal_tick;
-bool horizontal_move = false;
-bool continuous_horizontal = false;
-
-bool fast_shift_left = false;
-bool fast_shift_right = false;
-bool fast_shift_down = false;
-bool fast_rotate = false;
-
-Tetromino tetromino;
 int current_level_num = 1;
-Level init_level = {.tick = INIT_TICK,
-                    .score_points = NEW_LEVEL_POINTS,
-                    .empty_cell_color = (Color){0x1B, 0x49, 0x65, 0xFF},
+Level init_level = {.empty_cell_color = (Color){0x1B, 0x49, 0x65, 0xFF},
                     .alive_cell_color = (Color){0x5F, 0xA8, 0xD3, 0xFF},
                     .background_color = BLACK};
 Level current_level;
 
-size_t game_points = 0;
-
 void UpdateDrawFrame(void);
 
-void dump_board(void) {
+void dump_board(const Row *board) {
   printf("BOARD DUMP\n");
-  for (int y = 0; y < BOARD_HEIGHT + BOARD_HEIGHT_EXTRA; y++) {
+  for (int y = 0; y < BOARD_ROWS; y++) {
     for (int x = 0; x < BOARD_WIDTH; x++) {
-      printf("%s", board[x][y] ? "[*]" : "[ ]");
+      printf("%s", board[y] & COLUMN_BIT(x) ? "[*]" : "[ ]");
     }
     printf("\n");
   }
 }
 
-bool is_tetromino_at(int part_index, Vector2 index) {
-  for (int i = 0; i < 4; i++) {
-    if (i == part_index)
-      continue;
-    if (Vector2Equals(tetromino.parts[i], index)) {
-      return true;
-    }
-  }
-  return false;
-}
-
-void board_remove_tetromino(void) {
-  for (size_t i = 0; i < 4; i++) {
-    board[(int)tetromino.parts[i].x][(int)tetromino.parts[i].y] = false;
-  }
-}
-
-void board_add_tetromino(void) {
-  for (size_t i = 0; i < 4; i++) {
-    board[(int)tetromino.parts[i].x][(int)tetromino.parts[i].y] = true;
-  }
-}
-
-bool within_board(Vector2 index) {
-  bool is_within = index.x >= 0 && index.x < BOARD_WIDTH && index.y >= 0 &&
-                   index.y < BOARD_HEIGHT + BOARD_HEIGHT_EXTRA;
-  return is_within;
-}
-
-void move_tetromino(Direction dir) {
-  board_remove_tetromino();
-  switch (dir) {
-  case Down:
-    for (size_t i = 0; i < 4; i++) {
-      if (!within_board(Vector2Add(tetromino.parts[i], (Vector2){0, 1})) ||
-          board[(int)tetromino.parts[i].x][(int)tetromino.parts[i].y + 1]) {
-        goto _no_move;
-      }
-    }
-
-    tetromino.pos.y++;
-    for (size_t i = 0; i < 4; i++) {
-      tetromino.parts[i].y += 1;
-    }
-    break;
-  case Left:
-    for (size_t i = 0; i < 4; i++) {
-      if (!within_board(Vector2Add(tetromino.parts[i], (Vector2){-1, 0})) ||
-          board[(int)tetromino.parts[i].x - 1][(int)tetromino.parts[i].y]) {
-        goto _no_move;
-      }
-    }
-
-    tetromino.pos.x--;
-    for (size_t i = 0; i < 4; i++) {
-      tetromino.parts[i].x -= 1;
-    }
-    break;
-  case Right:
-    for (size_t i = 0; i < 4; i++) {
-      if (!within_board(Vector2Add(tetromino.parts[i], (Vector2){1, 0})) ||
-          board[(int)tetromino.parts[i].x + 1][(int)tetromino.parts[i].y]) {
-        goto _no_move;
-      }
-    }
-
-    tetromino.pos.x++;
-    for (size_t i = 0; i < 4; i++) {
-      tetromino.parts[i].x += 1;
-    }
-    break;
-  }
-_no_move:
-  board_add_tetromino();
-}
-
-void rotate_tetromino(void) {
-  int new_state = tetromino.state;
-  board_remove_tetromino();
-
-  new_state++;
-  if (new_state >= tet_state_count[tetromino.type]) {
-    new_state = 0;
-  }
-  // printf("Tetromino new state: %d\n", new_state);
-  for (size_t i = 0; i < 4; i++) {
-    Vector2 new_part_pos =
-        Vector2Add(tet_states[tetromino.type + new_state][i], tetromino.pos);
-    if (!within_board(new_part_pos) ||
-        board[(int)new_part_pos.x][(int)new_part_pos.y]) {
-      // printf("No rotation!\n");
-      goto _no_rotation;
-    }
-  }
-  tetromino.state = new_state;
-  for (size_t i = 0; i < 4; i++) {
-    Vector2 new_part_pos =
-        Vector2Add(tet_states[tetromino.type + new_state][i], tetromino.pos);
-    tetromino.parts[i] = new_part_pos;
-  }
-
-_no_rotation:
-  board_add_tetromino();
-}
-
-bool full_lines(void) {
-  clear_lowest_y = 0;
-  clear_shift_amount = 0;
-  int y, x;
-  for (y = BOARD_HEIGHT + BOARD_HEIGHT_EXTRA - 1; y > BOARD_HEIGHT_EXTRA; y--) {
-    for (x = 0; x < BOARD_WIDTH; x++) {
-      if (!board[x][y]) {
-        goto _out_loop;
-      }
-    }
-    if (y > clear_lowest_y)
-      clear_lowest_y = y;
-    clear_shift_amount++;
-  _out_loop:
-  }
-  clear_animation = clear_lowest_y;
-  return clear_lowest_y != 0;
-}
-
 Level create_random_level(void) {
-  srand(time(NULL));
-  return (Level){.tick = current_level.tick - TICK_INC,
-                 .score_points = NEW_LEVEL_POINTS,
-                 .empty_cell_color =
-                     empty_cell_colors[rand() % (sizeof(empty_cell_colors) /
-                                                 sizeof(Color))],
-                 .alive_cell_color =
-                     alive_cell_colors[rand() % (sizeof(alive_cell_colors) /
-                                                 sizeof(Color))],
-                 .background_color =
-                     background_colors[rand() % (sizeof(background_colors) /
-                                                 sizeof(Color))]};
+  return (Level){
+      .empty_cell_color = empty_cell_colors[rng_below(
+          &level_rng, sizeof(empty_cell_colors) / sizeof(Color))],
+      .alive_cell_color = alive_cell_colors[rng_below(
+          &level_rng, sizeof(alive_cell_colors) / sizeof(Color))],
+      .background_color = background_colors[rng_below(
+          &level_rng, sizeof(background_colors) / sizeof(Color))]};
 }
 
-void clear_full_lines(void) {
-  printf("clear_lowest_y: %d clear_shift_amount: %d\n", clear_lowest_y,
-         clear_shift_amount);
-  // dump_board();
-  int x, y;
-  if (clear_lowest_y != 0) {
-    for (y = clear_lowest_y; y >= BOARD_HEIGHT_EXTRA + clear_shift_amount;
-         y--) {
-      for (x = 0; x < BOARD_WIDTH; x++) {
-        assert(y - clear_shift_amount > BOARD_HEIGHT_EXTRA - 1 &&
-               "You are stupid");
-        board[x][y] = board[x][y - clear_shift_amount];
-      }
-    }
-  }
-  // dump_board();
-  game_points += clear_shift_amount * CLEAR_LINE_POINTS;
-  printf("Game Points: %lld\n", game_points);
-  clear_lowest_y = 0;
-  clear_shift_amount = 0;
-
-  if (game_points >= NEW_LEVEL_POINTS * current_level_num) {
-    current_level = create_random_level();
-    current_level_num++;
-    printf("Level UP!\n");
-  }
-}
-
-bool clear_animation_done(void) {
-  if (!clear_animation)
-    return true;
-
-  int x, y;
-  clear_animation_time += delta_time;
-  clear_animation_switch_time += delta_time;
-
-  if (clear_animation_time >= CLEAR_ANIMATION_DURATION) {
-    printf("Animating clear is DONE\n");
-    clear_animation = false;
-    clear_animation_time = 0.0;
-    clear_animation_switch_time = 0.0;
-
-    clear_full_lines();
-    return true;
-  }
+Game_Input read_input(void) {
+  Game_Input input = {0};
 
-  if (clear_lowest_y != 0) {
-    for (y = clear_lowest_y; y > clear_lowest_y - clear_shift_amount; y--) {
-      for (x = 0; x < BOARD_WIDTH; x++) {
-        board[x][y] =
-            clear_animation_switch_time >= CLEAR_ANIMATION_SWITCH_DURATION
-                ? true
-                : false;
-      }
-    }
-    if (clear_animation_switch_time >= CLEAR_ANIMATION_SWITCH_DURATION) {
-      clear_animation_switch_time = 0.0f;
-    }
+  input.rotate_pressed =
+      IsKeyPressed(KEY_R) || IsKeyPressed(KEY_UP) ||
+      ((gesture == GESTURE_SWIPE_DOWN || gesture == GESTURE_SWIPE_UP) &&
+       touch_pos[0].y <
+           screen_height - screen_height * TOUCH_FAST_DOWN_HEIGHT_RATIO) ||
+      !FloatEquals(GetMouseWheelMove(), 0.0f);
+  if (input.rotate_pressed) {
+    last_tap_time = current_time;
+    return input;
   }
-  return false;
-}
 
-void game_over(void) {
-  current_level = init_level;
-  current_level_num = 1;
-  game_points = 0;
-  game_over_animation = true;
-}
+  input.hard_drop_pressed = IsKeyPressed(KEY_SPACE);
 
-bool game_over_animation_done(void) {
-  if (!game_over_animation)
-    return true;
-  int x, y;
-  game_over_animation_time += delta_time;
-  for (y = game_over_animation_y; y < BOARD_HEIGHT + BOARD_HEIGHT_EXTRA; y++) {
-    for (x = game_over_animation_x; x < BOARD_WIDTH; x++) {
-      if (game_over_animation_time < GAME_OVER_ANIMATION_CELL_TIME / y)
-        return false;
-      if (board[x][y]) {
-        board[x][y] = false;
-        game_over_animation_time = 0;
-        return false;
-      } else {
-        continue;
-      }
-    }
-  }
-  game_over();
-  game_over_animation = false;
-  return true;
-}
+  input.left_pressed =
+      IsKeyPressed(KEY_A) || IsKeyPressed(KEY_LEFT) ||
+      (gesture == GESTURE_TAP &&
+       current_time - last_tap_time > SINGLE_TAP_DELAY &&
+       touch_pos[0].y <
+           screen_height - screen_height * TOUCH_FAST_DOWN_HEIGHT_RATIO &&
+       touch_pos[0].x < screen_width / 2.0f);
 
-bool tetromino_grounded(void) {
-  for (size_t i = 0; i < 4; i++) {
-    Vector2 cell_below = {tetromino.parts[i].x, tetromino.parts[i].y + 1};
-    // On the ground
-    if (!within_board(cell_below)) {
-      // assert(false && "kill tetromino");
-      return true;
-    }
+  input.right_pressed =
+      IsKeyPressed(KEY_D) || IsKeyPressed(KEY_RIGHT) ||
+      (gesture == GESTURE_TAP &&
+       current_time - last_tap_time > SINGLE_TAP_DELAY &&
+       touch_pos[0].y <
+           screen_height - screen_height * TOUCH_FAST_DOWN_HEIGHT_RATIO &&
+       touch_pos[0].x >= screen_width / 2.0f);
 
-    // On the pile of dead tetrominos
-    if (!is_tetromino_at(i, cell_below) &&
-        board[(int)cell_below.x][(int)cell_below.y]) {
-      // assert(false && "kill tetromino");
-      return true;
-    }
+  if (input.left_pressed || input.right_pressed) {
+    last_tap_time = current_time;
   }
-  return false;
-}
 
-void refill_tetromino_bag(void) {
-  Tetromino t;
-  int r;
-  for (size_t i = 0; i < 7; i++) {
-    tetromino_bag[i] = (Tetromino){
-        .type = tetromino_types[i], .state = 0, .pos = (Vector2){0.0f, 0.0f}};
-    memcpy(tetromino_bag[i].parts, tet_states[tetromino_types[i]],
-           sizeof(Parts));
-  }
+  input.left_down = IsKeyDown(KEY_A) || IsKeyDown(KEY_LEFT);
+  input.right_down = IsKeyDown(KEY_D) || IsKeyDown(KEY_RIGHT);
 
-  srand(time(NULL));
-  for (size_t i = 6; i >= 1; i--) {
-    r = rand() % i;
-    t = tetromino_bag[r];
-    tetromino_bag[r] = tetromino_bag[i];
-    tetromino_bag[i] = t;
-  }
-  tetromino_bag_used = 0;
+  input.fast_down =
+      (IsKeyDown(KEY_S) || IsKeyDown(KEY_DOWN)) ||
+      (gesture == GESTURE_HOLD &&
+       touch_pos[0].y >=
+           screen_height - screen_height * TOUCH_FAST_DOWN_HEIGHT_RATIO);
+
+  return input;
 }
 
-void spawn_tetromino(void) {
-  if (tetromino_bag_used == 7) {
-    refill_tetromino_bag();
-  }
-  tetromino = tetromino_bag[tetromino_bag_used++];
-  for (size_t i = 0; i < 4; i++) {
-    tetromino.pos.x = TET_START_OFFSET - tet_max_widths[tetromino.type] / 2.0f;
-    tetromino.parts[i].x +=
-        TET_START_OFFSET - tet_max_widths[tetromino.type] / 2.0f;
-  }
+// The bot's input for the next tick. A new piece gets a new plan, and so
+// does one whose plan went out of reach.
+Game_Input autoplay_input(void) {
+  if (game.clear_animation || game.game_over_animation)
+    return (Game_Input){0};
+  Bot_Move move = BOT_WAIT;
+  if (autoplay_planned_bag_used == game.tetromino_bag_used)
+    move = bot_next_move(game.board, game.tetromino, autoplay_target);
+  if (move == BOT_WAIT) {
+    bool found =
+        search_ready
+            ? search_choose_game(&search, &game, &autoplay_target)
+            : bot_choose(&bot, game.board, game.tetromino, &autoplay_target);
+    if (!found)
+      return (Game_Input){0};
+    autoplay_planned_bag_used = game.tetromino_bag_used;
+    move = bot_next_move(game.board, game.tetromino, autoplay_target);
+  }
+  return bot_input(move);
 }
 
 void UpdateDrawFrame() {
-  if (last_tick_time >= current_level.tick) {
-    last_tick_time = 0.0;
-    tick_time = true;
-  }
-
   gesture = GetGestureDetected();
   touch_pos[0] = GetTouchPosition(0);
   touch_pos[1] = GetTouchPosition(1);
@@ -500,7 +199,6 @@ void UpdateDrawFrame() {
 
   current_time = GetTime();
   delta_time = GetFrameTime();
-  last_tick_time += delta_time;
 
   screen_width = GetScreenWidth();
   screen_height = GetScreenHeight();
@@ -516,115 +214,50 @@ void UpdateDrawFrame() {
   int x0 = (screen_width - cell_width * BOARD_WIDTH - cell_padding) / 2;
   int y0 = (screen_height - cell_width * (BOARD_HEIGHT)-cell_padding) / 2;
 
-  // Clear up: remove clear_animation check. make like with game over
-  if (!clear_animation_done()) {
-    goto _draw;
-  }
-  if (game_points >= NEW_LEVEL_POINTS * current_level_num) {
-    current_level = create_random_level();
-    current_level_num++;
-    printf("Level UP!\n");
-    printf("Tick time: %f\n", current_level.tick);
+  if (IsKeyPressed(KEY_P)) {
+    autoplay = !autoplay;
+    autoplay_planned_bag_used = -1;
   }
 
-  if (!game_over_animation_done()) {
-    goto _draw;
-  }
-
-  if (tick_time) {
-    if (tetromino_grounded()) {
-      printf("Grounded! Type: %d\n", tetromino.type);
-
-      for (size_t i = 0; i < BOARD_WIDTH; i++) {
-        if (board[i][BOARD_HEIGHT_EXTRA]) {
-          game_over_animation = true;
-          game_over_animation_y = BOARD_HEIGHT_EXTRA;
-          game_over_animation_x = 0;
-          goto _draw;
-        }
-      }
+  Game_Input input = read_input();
+  pending_input.rotate_pressed |= input.rotate_pressed;
+  pending_input.left_pressed |= input.left_pressed;
+  pending_input.right_pressed |= input.right_pressed;
+  pending_input.hard_drop_pressed |= input.hard_drop_pressed;
+  pending_input.left_down = input.left_down;
+  pending_input.right_down = input.right_down;
+  pending_input.fast_down = input.fast_down;
 
-      if (!clear_animation && !full_lines()) {
-        spawn_tetromino();
-      }
+  tick_accumulator += Clamp(delta_time, 0.0f, MAX_FRAME_TIME);
+  while (tick_accumulator >= GAME_TICK_SECONDS) {
+    if (autoplay) {
+      game_step(&game, autoplay_input());
     } else {
-      move_tetromino(Down);
-      tick_time = false;
-      goto _draw;
-    }
-  }
-
-  if (IsKeyPressed(KEY_R) || IsKeyPressed(KEY_UP) ||
-      ((gesture == GESTURE_SWIPE_DOWN || gesture == GESTURE_SWIPE_UP) &&
-       touch_pos[0].y <
-           screen_height - screen_height * TOUCH_FAST_DOWN_HEIGHT_RATIO) ||
-      !FloatEquals(GetMouseWheelMove(), 0.0f)) {
-    rotate_tetromino();
-    last_tap_time = current_time;
-    goto _draw;
-  }
-
-  if (IsKeyPressed(KEY_A) || IsKeyPressed(KEY_LEFT) ||
-      (gesture == GESTURE_TAP &&
-       current_time - last_tap_time > SINGLE_TAP_DELAY &&
-       touch_pos[0].y <
-           screen_height - screen_height * TOUCH_FAST_DOWN_HEIGHT_RATIO &&
-       touch_pos[0].x < screen_width / 2.0f)) {
-    last_horizontal_tick = 0;
-    move_tetromino(Left);
-    last_tap_time = current_time;
-  }
-
-  if (IsKeyPressed(KEY_D) || IsKeyPressed(KEY_RIGHT) ||
-      (gesture == GESTURE_TAP &&
-       current_time - last_tap_time > SINGLE_TAP_DELAY &&
-       touch_pos[0].y <
-           screen_height - screen_height * TOUCH_FAST_DOWN_HEIGHT_RATIO &&
-       touch_pos[0].x >= screen_width / 2.0f)) {
-    last_horizontal_tick = 0;
-    move_tetromino(Right);
-    last_tap_time = current_time;
-  }
-
-  // Continuous press
-
-  // Both directions are pressed
-  if ((IsKeyDown(KEY_A) || IsKeyDown(KEY_LEFT)) &&
-      (IsKeyDown(KEY_D) || IsKeyDown(KEY_RIGHT))) {
-    last_horizontal_tick = 0;
-  }
-
-  if (IsKeyDown(KEY_A) || IsKeyDown(KEY_LEFT)) {
-    last_horizontal_tick += delta_time;
-
-    if (last_horizontal_tick >= FAST_TICK_HORIZONTAL) {
-      last_horizontal_tick = 0;
-      move_tetromino(Left);
+      game_step(&game, pending_input);
     }
+    pending_input.rotate_pressed = false;
+    pending_input.left_pressed = false;
+    pending_input.right_pressed = false;
+    pending_input.hard_drop_pressed = false;
+    tick_accumulator -= GAME_TICK_SECONDS;
   }
 
-  if (IsKeyDown(KEY_D) || IsKeyDown(KEY_RIGHT)) {
-    last_horizontal_tick += delta_time;
-
-    if (last_horizontal_tick >= FAST_TICK_HORIZONTAL) {
-      last_horizontal_tick = 0;
-      move_tetromino(Right);
+  if (game.level_num != current_level_num) {
+    if (game.level_num == 1) {
+      current_level = init_level;
+    } else {
+      current_level = create_random_level();
+      printf("Level UP!\n");
+      printf("Gravity ticks: %d\n", game.gravity_ticks);
     }
+    current_level_num = game.level_num;
   }
 
-  if ((IsKeyDown(KEY_S) || IsKeyDown(KEY_DOWN)) ||
-      (gesture == GESTURE_HOLD &&
-       touch_pos[0].y >=
-           screen_height - screen_height * TOUCH_FAST_DOWN_HEIGHT_RATIO)) {
-    last_tick_time += FAST_TICK_VERTICAL * delta_time;
-  }
-
-_draw:
   BeginDrawing();
   ClearBackground(current_level.background_color);
   for (size_t y = 0; y < BOARD_HEIGHT; y++) {
     for (size_t x = 0; x < BOARD_WIDTH; x++) {
-      if (board[x][y + BOARD_HEIGHT_EXTRA]) {
+      if (game.board[y + BOARD_HEIGHT_EXTRA] & COLUMN_BIT(x)) {
         DrawRectangle(x0 + x * cell_width + cell_padding,
                       y0 + y * cell_width + cell_padding,
                       cell_width - cell_padding, cell_width - cell_padding,
@@ -637,10 +270,60 @@ _draw:
       }
     }
   }
+
+  // While animating the tetromino is already locked into the board
+  if (!game.clear_animation && !game.game_over_animation) {
+    Tetromino tet = game.tetromino;
+    int ghost_y = tet.pos.y + tetromino_drop_distance(&game.metrics, tet);
+    for (size_t i = 0; i < 4; i++) {
+      Cell part = tet_states[tet.type][tet.state][i];
+      if (ghost_y + part.y < BOARD_HEIGHT_EXTRA)
+        continue;
+      DrawRectangle(
+          x0 + (tet.pos.x + part.x) * cell_width + cell_padding,
+          y0 + (ghost_y + part.y - BOARD_HEIGHT_EXTRA) * cell_width +
+              cell_padding,
+          cell_width - cell_padding, cell_width - cell_padding,
+          ColorAlpha(current_level.alive_cell_color, GHOST_ALPHA));
+    }
+
+    Vector2 pos = {tet.pos.x, tet.pos.y};
+    // Slide from where the last tick found the tetromino, unless it was
+    // rotated or respawned in between
+    if (game.tetromino_prev.type == tet.type &&
+        game.tetromino_prev.state == tet.state) {
+      float alpha = tick_accumulator / GAME_TICK_SECONDS;
+      pos = Vector2Lerp(
+          (Vector2){game.tetromino_prev.pos.x, game.tetromino_prev.pos.y}, pos,
+          alpha);
+    }
+    for (size_t i = 0; i < 4; i++) {
+      Cell part = tet_states[tet.type][tet.state][i];
+      if (tet.pos.y + part.y < BOARD_HEIGHT_EXTRA)
+        continue;
+      float x = pos.x + part.x;
+      float y = pos.y + part.y - BOARD_HEIGHT_EXTRA;
+      DrawRectangle(x0 + x * cell_width + cell_padding,
+                    y0 + y * cell_width + cell_padding,
+                    cell_width - cell_padding, cell_width - cell_padding,
+                    current_level.alive_cell_color);
+    }
+  }
   EndDrawing();
 }
 
-int main(void) {
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-autoplay") == 0)
+      autoplay = true;
+  }
+  bot_init(&bot, &bot_default_weights);
+  pool_init(&pool, pool_default_threads());
+  tt_ready = tt_init(&tt, TT_DEFAULT_BYTES);
+  search_ready = search_init(&search, &pool, tt_ready ? &tt : NULL,
+                             &bot_default_weights, SEARCH_DEFAULT_BEAM_WIDTH,
+                             SEARCH_DEFAULT_TIME_BUDGET);
+
   InitWindow(800, 900, "tetris");
 #ifndef __EMSCRIPTEN__
   Image icon = {.data = icon_rgba,
@@ -664,12 +347,10 @@ int main(void) {
   alive_cell_color = GetColor(0x5fa8d3FF);
   background_color = BLACK;
 
-  last_tick_time = 0;
-  last_horizontal_tick = 0;
-
+  uint64_t seed = (uint64_t)time(NULL);
+  rng_seed(&level_rng, ~seed);
   current_level = init_level;
-  refill_tetromino_bag();
-  spawn_tetromino();
+  game_init(&game, seed);
 
 #if defined(PLATFORM_WEB)
   emscripten_set_main_loop(UpdateDrawFrame, 0, 1);
@@ -681,5 +362,10 @@ int main(void) {
 
 #endif
   CloseWindow();
+  if (search_ready)
+    search_free(&search);
+  if (tt_ready)
+    tt_free(&tt);
+  pool_free(&pool);
   return 0;
 }
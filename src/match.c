@@ -0,0 +1,433 @@
+// match: plays two bot configurations against each other on the same
+// seeded games until a sequential probability ratio test decides between
+// them, the way chess engine testers accept or reject a patch.
+//
+//   ./build/match <a> <b> [pieces] [max_games] [budget_ms] [elo0] [elo1]
+//                 [threads]
+//
+// A configuration is greedy, beam or mcts, optionally followed by the seven
+// weights of Bot_Weights in order, e.g.
+//
+//   greedy:-0.5,-7.5,-0.5,-3,-9,-3.5,3.5
+//
+// Every seed is played by a and by b from the same bag, to top out or
+// pieces pieces. The higher score wins the pair, pieces survived break
+// ties, otherwise it's a draw. Pairs run in parallel, one game per worker:
+// each worker owns its searches and runs them on a pool of its own without
+// threads, so a search gets a core and budget_ms of it per piece.
+//
+// After every round of pairs the generalized SPRT of H0 "a is elo0 better
+// than b" against H1 "a is elo1 better" is updated with the normal
+// approximation of the log likelihood ratio, and the match stops when it
+// leaves the bounds for alpha = beta = 0.05 or after max_games pairs.
+// Elo is the logistic one of chess, from the pairs' mean score.
+
+#include "args.h"
+#include "bot.h"
+#include "game.h"
+#include "mcts.h"
+#include "pool.h"
+#include "search.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ALPHA 0.05
+#define BETA 0.05
+// Pairs per worker between two looks at the test
+#define ROUND_PAIRS 2
+#define SIDE_COUNT 2
+
+typedef enum {
+  PLAYER_GREEDY,
+  PLAYER_BEAM,
+  PLAYER_MCTS,
+  PLAYER_COUNT,
+} Player;
+
+static const char *player_names[PLAYER_COUNT] = {"greedy", "beam", "mcts"};
+
+typedef struct {
+  const char *spec;
+  Player player;
+  Bot_Weights weights;
+} Config;
+
+// What one worker plays one side with
+typedef struct {
+  Pool pool;
+  Bot bot;
+  Search search;
+  Mcts mcts;
+} Engine;
+
+typedef struct {
+  uint32_t pieces;
+  uint32_t lines;
+  uint64_t points;
+} Result;
+
+typedef struct {
+  Config configs[SIDE_COUNT];
+  // [worker * SIDE_COUNT + side]
+  Engine *engines;
+  uint64_t max_pieces;
+  uint64_t first_seed;
+  // [pair * SIDE_COUNT + side] of the round
+  Result *results;
+} Match;
+
+static Pool pool;
+
+static bool parse_config(const char *spec, Config *config) {
+  config->spec = spec;
+  config->weights = bot_default_weights;
+  size_t name_length = strcspn(spec, ":");
+  int player = 0;
+  while (player < PLAYER_COUNT &&
+         (strlen(player_names[player]) != name_length ||
+          strncmp(spec, player_names[player], name_length) != 0)) {
+    player++;
+  }
+  if (player == PLAYER_COUNT)
+    return false;
+  config->player = player;
+  if (spec[name_length] == '\0')
+    return true;
+
+  float w[sizeof(Bot_Weights) / sizeof(float)];
+  const char *p = spec + name_length + 1;
+  for (size_t i = 0; i < sizeof(w) / sizeof(float); i++) {
+    char *end;
+    w[i] = strtof(p, &end);
+    if (end == p || *end != (i + 1 < sizeof(w) / sizeof(float) ? ',' : '\0'))
+      return false;
+    p = end + 1;
+  }
+  memcpy(&config->weights, w, sizeof(w));
+  return true;
+}
+
+static bool engine_init(Engine *engine, const Config *config, double budget,
+                        uint64_t seed) {
+  pool_init(&engine->pool, 0);
+  bot_init(&engine->bot, &config->weights);
+  switch (config->player) {
+  case PLAYER_BEAM:
+    return search_init(&engine->search, &engine->pool, NULL,
+                       &config->weights, SEARCH_DEFAULT_BEAM_WIDTH, budget);
+  case PLAYER_MCTS:
+    return mcts_init(&engine->mcts, &engine->pool, NULL, &config->weights,
+                     MCTS_DEFAULT_TABLE_BITS, MCTS_DEFAULT_HORIZON, budget,
+                     seed);
+  default:
+    return true;
+  }
+}
+
+static void engine_free(Engine *engine, const Config *config) {
+  if (config->player == PLAYER_BEAM)
+    search_free(&engine->search);
+  if (config->player == PLAYER_MCTS)
+    mcts_free(&engine->mcts);
+  pool_free(&engine->pool);
+}
+
+static Result play(Engine *engine, Player player, uint64_t seed,
+                   uint64_t max_pieces) {
+  Game_State g;
+  game_init(&g, seed);
+  Result result = {0};
+  while (result.pieces < max_pieces) {
+    Tetromino best;
+    bool found = false;
+    switch (player) {
+    case PLAYER_GREEDY:
+      found = bot_choose(&engine->bot, g.board, g.tetromino, &best);
+      break;
+    case PLAYER_BEAM:
+      found = search_choose_game(&engine->search, &g, &best);
+      break;
+    default:
+      found = mcts_choose_game(&engine->mcts, &g, &best);
+      break;
+    }
+    if (!found)
+      break;
+    int lines = game_place(&g, best);
+    if (lines < 0)
+      break;
+    result.lines += lines;
+    result.pieces++;
+  }
+  result.points = g.points;
+  return result;
+}
+
+static void play_pair(void *context, size_t index, size_t worker) {
+  Match *match = context;
+  for (size_t side = 0; side < SIDE_COUNT; side++) {
+    match->results[index * SIDE_COUNT + side] =
+        play(&match->engines[worker * SIDE_COUNT + side],
+             match->configs[side].player, match->first_seed + index,
+             match->max_pieces);
+  }
+}
+
+// Of a, 1 a win, 0.5 a draw
+static double pair_score(const Result *a, const Result *b) {
+  if (a->points != b->points)
+    return a->points > b->points;
+  if (a->pieces != b->pieces)
+    return a->pieces > b->pieces;
+  return 0.5;
+}
+
+static double elo_to_score(double elo) {
+  return 1 / (1 + pow(10, -elo / 400));
+}
+
+static double score_to_elo(double score) {
+  if (score <= 0)
+    return -INFINITY;
+  if (score >= 1)
+    return INFINITY;
+  return -400 * log10(1 / score - 1);
+}
+
+// Counts are doubles for the pseudo pairs tally_llr adds
+typedef struct {
+  double wins, draws, losses;
+} Tally;
+
+static double tally_games(const Tally *t) {
+  return t->wins + t->draws + t->losses;
+}
+
+static double tally_score(const Tally *t) {
+  return (t->wins + 0.5 * t->draws) / tally_games(t);
+}
+
+// Variance of one pair's score
+static double tally_variance(const Tally *t) {
+  double n = tally_games(t), s = tally_score(t);
+  return (t->wins * (1 - s) * (1 - s) + t->draws * (0.5 - s) * (0.5 - s) +
+          t->losses * s * s) /
+         n;
+}
+
+// Log likelihood ratio of elo1 over elo0. Half a win and half a loss are
+// added first: while every pair ends the same the variance is 0, and
+// without them a match of only wins or only draws could never stop.
+static double tally_llr(const Tally *t, double elo0, double elo1) {
+  Tally r = {t->wins + 0.5, t->draws, t->losses + 0.5};
+  double s0 = elo_to_score(elo0), s1 = elo_to_score(elo1);
+  return tally_games(t) * (s1 - s0) * (2 * tally_score(&r) - s0 - s1) /
+         (2 * tally_variance(&r));
+}
+
+// Pairs a that wins, or loses, every one needs to take the test past
+// bound, 0 when max_games pairs aren't enough
+static uint64_t sweep_length(bool wins, double elo0, double elo1,
+                             double bound, uint64_t max_games) {
+  Tally t = {0};
+  for (uint64_t n = 1; n <= max_games; n++) {
+    if (wins)
+      t.wins = n;
+    else
+      t.losses = n;
+    double llr = tally_llr(&t, elo0, elo1);
+    if (wins ? llr >= bound : llr <= bound)
+      return n;
+  }
+  return 0;
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void print_distribution(const char *name, uint64_t *values,
+                               size_t count) {
+  qsort(values, count, sizeof(uint64_t), compare_u64);
+  double sum = 0, sum_sq = 0;
+  for (size_t i = 0; i < count; i++) {
+    sum += values[i];
+    sum_sq += (double)values[i] * values[i];
+  }
+  double mean = sum / count;
+  double deviation = sqrt(fmax(0, sum_sq / count - mean * mean));
+  printf("  %-7s mean %9.1f sd %8.1f min %7llu p10 %7llu median %7llu "
+         "p90 %7llu max %7llu\n",
+         name, mean, deviation, (unsigned long long)values[0],
+         (unsigned long long)values[count / 10],
+         (unsigned long long)values[count / 2],
+         (unsigned long long)values[count * 9 / 10],
+         (unsigned long long)values[count - 1]);
+}
+
+static void usage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s <a> <b> [pieces] [max_games] [budget_ms] [elo0] "
+          "[elo1] [threads]\n",
+          program);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3 || argc > 9) {
+    usage(argv[0]);
+    return 1;
+  }
+  Match match = {0};
+  for (size_t side = 0; side < SIDE_COUNT; side++) {
+    if (!parse_config(argv[1 + side], &match.configs[side])) {
+      fprintf(stderr, "Bad configuration %s\n", argv[1 + side]);
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  match.max_pieces = 1000;
+  uint64_t max_games = 100000, threads = pool_default_threads();
+  double budget = 1.0, elo0 = 0, elo1 = 10;
+  if ((argc > 3 && !arg_count(argv[3], &match.max_pieces)) ||
+      (argc > 4 && !arg_count(argv[4], &max_games)) ||
+      (argc > 5 && !arg_number(argv[5], &budget)) ||
+      (argc > 6 && !arg_number(argv[6], &elo0)) ||
+      (argc > 7 && !arg_number(argv[7], &elo1)) ||
+      (argc > 8 && !arg_count(argv[8], &threads)) || max_games == 0 ||
+      budget <= 0) {
+    usage(argv[0]);
+    return 1;
+  }
+  budget /= 1000.0;
+
+  // game_init fills the Zobrist keys on first use, not from many threads
+  init_zobrist();
+  pool_init(&pool, threads);
+  size_t workers = pool_worker_count(&pool);
+  size_t round = workers * ROUND_PAIRS;
+  match.engines = malloc(workers * SIDE_COUNT * sizeof(Engine));
+  match.results = malloc(round * SIDE_COUNT * sizeof(Result));
+  uint64_t *values[SIDE_COUNT][3];
+  for (size_t side = 0; side < SIDE_COUNT; side++) {
+    for (size_t i = 0; i < 3; i++) {
+      values[side][i] = malloc(max_games * sizeof(uint64_t));
+      if (values[side][i] == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+      }
+    }
+  }
+  if (match.engines == NULL || match.results == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+  for (size_t i = 0; i < workers * SIDE_COUNT; i++) {
+    if (!engine_init(&match.engines[i], &match.configs[i % SIDE_COUNT],
+                     budget, i + 1)) {
+      fprintf(stderr, "Out of memory\n");
+      return 1;
+    }
+  }
+
+  double lower = log(BETA / (1 - ALPHA));
+  double upper = log((1 - BETA) / ALPHA);
+  if (!(elo1 > elo0)) {
+    fprintf(stderr, "elo1 has to be above elo0\n");
+    return 1;
+  }
+  // The quickest verdicts, if max_games can't hold them none can come
+  uint64_t to_upper = sweep_length(true, elo0, elo1, upper, max_games);
+  uint64_t to_lower = sweep_length(false, elo0, elo1, lower, max_games);
+  if (to_upper == 0 || to_lower == 0) {
+    fprintf(stderr,
+            "No verdict can come within %llu pairs for elo0 %.1f elo1 "
+            "%.1f\n",
+            (unsigned long long)max_games, elo0, elo1);
+    return 1;
+  }
+  printf("%s vs %s, up to %llu pieces, %.1f ms per piece, %zu workers\n",
+         match.configs[0].spec, match.configs[1].spec,
+         (unsigned long long)match.max_pieces, budget * 1000.0, workers);
+  printf("SPRT elo0 %.1f elo1 %.1f, bounds [%.2f, %.2f], a verdict takes at "
+         "least %llu pairs\n",
+         elo0, elo1, lower, upper,
+         (unsigned long long)(to_upper < to_lower ? to_upper : to_lower));
+
+  Tally tally = {0};
+  uint64_t games = 0;
+  double llr = 0;
+  double start = pool_seconds(), last_print = start;
+  while (games < max_games && llr > lower && llr < upper) {
+    size_t count = round;
+    if (count > max_games - games)
+      count = max_games - games;
+    match.first_seed = games + 1;
+    pool_run(&pool, play_pair, &match, count);
+
+    for (size_t i = 0; i < count; i++) {
+      const Result *r = &match.results[i * SIDE_COUNT];
+      double score = pair_score(&r[0], &r[1]);
+      tally.wins += score == 1;
+      tally.draws += score == 0.5;
+      tally.losses += score == 0;
+      for (size_t side = 0; side < SIDE_COUNT; side++) {
+        values[side][0][games + i] = r[side].points;
+        values[side][1][games + i] = r[side].lines;
+        values[side][2][games + i] = r[side].pieces;
+      }
+    }
+    games += count;
+    llr = tally_llr(&tally, elo0, elo1);
+    double now = pool_seconds();
+    if (now - last_print < 1)
+      continue;
+    last_print = now;
+    double seconds = now - start;
+    printf("\r%llu pairs, +%.0f =%.0f -%.0f, LLR %.2f, %.1f games/s   ",
+           (unsigned long long)games, tally.wins, tally.draws, tally.losses,
+           llr, 2 * games / seconds);
+    fflush(stdout);
+  }
+  double seconds = pool_seconds() - start;
+  printf("\n\n");
+
+  if (llr >= upper) {
+    printf("H1 accepted: %s is at least %.1f Elo better than %s\n",
+           match.configs[0].spec, elo1, match.configs[1].spec);
+  } else if (llr <= lower) {
+    printf("H0 accepted: %s is no more than %.1f Elo better than %s\n",
+           match.configs[0].spec, elo0, match.configs[1].spec);
+  } else {
+    printf("No verdict after %llu pairs\n", (unsigned long long)games);
+  }
+  double score = tally_score(&tally);
+  double margin = 1.96 * sqrt(tally_variance(&tally) / games);
+  printf("Score %.4f, Elo %+.1f (95%% %+.1f to %+.1f)\n", score,
+         score_to_elo(score), score_to_elo(score - margin),
+         score_to_elo(score + margin));
+  printf("%llu pairs in %.2f s, %.1f games/s\n", (unsigned long long)games,
+         seconds, 2 * games / seconds);
+  static const char *value_names[3] = {"points", "lines", "pieces"};
+  for (size_t side = 0; side < SIDE_COUNT; side++) {
+    printf("%s\n", match.configs[side].spec);
+    for (size_t i = 0; i < 3; i++) {
+      print_distribution(value_names[i], values[side][i], games);
+    }
+  }
+
+  for (size_t i = 0; i < workers * SIDE_COUNT; i++) {
+    engine_free(&match.engines[i], &match.configs[i % SIDE_COUNT]);
+  }
+  for (size_t side = 0; side < SIDE_COUNT; side++) {
+    for (size_t i = 0; i < 3; i++) {
+      free(values[side][i]);
+    }
+  }
+  free(match.engines);
+  free(match.results);
+  pool_free(&pool);
+  return 0;
+}
@@ -0,0 +1,382 @@
+#include "mcts.h"
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ALL_TYPES ((uint8_t)((1 << TET_TYPE_COUNT) - 1))
+// Values are in [0, 1], summed in this fixed point
+#define VALUE_ONE ((double)(1 << 24))
+// Probes before an insert gives up on a crowded part of the table
+#define MAX_PROBES 32
+// Most children UCT ever weighs at one node
+#define MAX_WIDEN 64
+
+bool mcts_init(Mcts *mcts, Pool *pool, Tt *tt, const Bot_Weights *weights,
+               size_t table_bits, size_t horizon, double time_budget,
+               uint64_t seed) {
+  memset(mcts, 0, sizeof(*mcts));
+  mcts->pool = pool;
+  mcts->tt = tt;
+  if (horizon == 0)
+    horizon = 1;
+  if (horizon > MCTS_MAX_HORIZON)
+    horizon = MCTS_MAX_HORIZON;
+  mcts->weights = *weights;
+  mcts->horizon = horizon;
+  mcts->time_budget = time_budget;
+  mcts->table_capacity = (size_t)1 << table_bits;
+  atomic_init(&mcts->table_used, 0);
+  atomic_init(&mcts->iteration_count, 0);
+
+  Rng rng;
+  rng_seed(&rng, seed);
+  for (size_t i = 0; i < sizeof(mcts->bag_keys) / sizeof(uint64_t); i++) {
+    mcts->bag_keys[i] = rng_next(&rng);
+  }
+
+  size_t workers = pool_worker_count(pool);
+  mcts->bots = malloc(workers * sizeof(Bot));
+  mcts->rngs = malloc(workers * sizeof(Rng));
+  mcts->table = malloc(mcts->table_capacity * sizeof(Mcts_Entry));
+  if (mcts->bots == NULL || mcts->rngs == NULL || mcts->table == NULL) {
+    mcts_free(mcts);
+    return false;
+  }
+  for (size_t i = 0; i < workers; i++) {
+    bot_init(&mcts->bots[i], weights);
+    rng_seed(&mcts->rngs[i], rng_next(&rng));
+  }
+  return true;
+}
+
+void mcts_free(Mcts *mcts) {
+  free(mcts->bots);
+  free(mcts->rngs);
+  free(mcts->table);
+  mcts->bots = NULL;
+  mcts->rngs = NULL;
+  mcts->table = NULL;
+}
+
+static Mcts_Entry *table_find(Mcts *mcts, uint64_t key) {
+  size_t mask = mcts->table_capacity - 1;
+  size_t slot = key & mask;
+  for (size_t i = 0; i < MAX_PROBES; i++, slot = (slot + 1) & mask) {
+    uint64_t found = atomic_load(&mcts->table[slot].key);
+    if (found == key)
+      return &mcts->table[slot];
+    if (found == 0)
+      return NULL;
+  }
+  return NULL;
+}
+
+// The entry for key, claimed if it's new. NULL when the table is too
+// crowded around key.
+static Mcts_Entry *table_insert(Mcts *mcts, uint64_t key) {
+  size_t mask = mcts->table_capacity - 1;
+  size_t slot = key & mask;
+  for (size_t i = 0; i < MAX_PROBES; i++, slot = (slot + 1) & mask) {
+    Mcts_Entry *entry = &mcts->table[slot];
+    uint64_t found = atomic_load(&entry->key);
+    if (found == 0) {
+      if (atomic_compare_exchange_strong(&entry->key, &found, key)) {
+        atomic_fetch_add(&mcts->table_used, 1);
+        return entry;
+      }
+      // Someone claimed it first, found now holds their key
+    }
+    if (found == key)
+      return entry;
+  }
+  return NULL;
+}
+
+// Locks placement into board and clears its full rows. Returns the new
+// board hash and adds the cleared rows to lines.
+static uint64_t place(Row *board, uint64_t hash, Tetromino placement,
+                      int *lines) {
+  hash ^= board_add_tetromino(board, placement);
+  Column full = board_full_rows(board);
+  if (full) {
+    board_clear_rows(board, full);
+    *lines += COLUMN_POPCOUNT(full);
+    hash = zobrist_board(board);
+  }
+  return hash;
+}
+
+static uint64_t afterstate_key(Mcts *mcts, uint64_t board_hash, uint8_t bag) {
+  uint64_t key = board_hash ^ mcts->bag_keys[bag];
+  // 0 marks a free slot
+  return key | (key == 0);
+}
+
+// The piece types of one iteration: the falling tetromino, the rest of its
+// bag in a random order, then whole bags
+static void sample_sequence(const Mcts *mcts, Rng *rng,
+                            uint8_t sequence[MCTS_MAX_HORIZON]) {
+  size_t count = 0;
+  sequence[count++] = mcts->tetromino.type;
+  size_t first = count;
+  for (int type = 0; type < TET_TYPE_COUNT; type++) {
+    if (mcts->bag_left >> type & 1)
+      sequence[count++] = type;
+  }
+  for (size_t i = count - 1; i > first; i--) {
+    size_t j = first + rng_below(rng, (uint32_t)(i - first + 1));
+    uint8_t t = sequence[i];
+    sequence[i] = sequence[j];
+    sequence[j] = t;
+  }
+  while (count < mcts->horizon) {
+    uint8_t types[7];
+    shuffle_tetromino_types(types, rng);
+    for (size_t i = 0; i < 7 && count < mcts->horizon; i++) {
+      sequence[count++] = types[i];
+    }
+  }
+}
+
+// UCT over the placements bot just evaluated. Only the best few by the
+// bot's score take part, more as the parent gets visited. An unvisited one
+// is taken first and added to the table, *expanded tells so. *entry is
+// NULL when the table had no room. Returns the index of the placement,
+// -1 when every placement tops out.
+static int select_child(Mcts *mcts, const Bot *bot, const Row *board,
+                        uint64_t board_hash, uint8_t bag,
+                        uint64_t parent_visits, Mcts_Entry **entry,
+                        bool *expanded) {
+  *entry = NULL;
+  *expanded = false;
+  int order[MAX_PLACEMENTS];
+  size_t count = 0;
+  for (size_t i = 0; i < bot->count; i++) {
+    if (!bot->topped_out[i])
+      order[count++] = (int)i;
+  }
+  if (count == 0)
+    return -1;
+  size_t widen = 2 + (size_t)sqrt((double)parent_visits);
+  if (widen > MAX_WIDEN)
+    widen = MAX_WIDEN;
+  if (widen > count)
+    widen = count;
+
+  Mcts_Entry *entries[MAX_WIDEN];
+  unsigned visits[MAX_WIDEN];
+  uint64_t total = 0;
+  for (size_t k = 0; k < widen; k++) {
+    // Selection sort, only the first few are ever needed
+    size_t top = k;
+    for (size_t j = k + 1; j < count; j++) {
+      if (bot->scores[order[j]] > bot->scores[order[top]])
+        top = j;
+    }
+    int t = order[k];
+    order[k] = order[top];
+    order[top] = t;
+
+    Row child[BOARD_ROWS + 3];
+    memcpy(child, board, sizeof(child));
+    int lines = 0;
+    uint64_t hash =
+        place(child, board_hash, bot->placements[order[k]], &lines);
+    uint64_t key = afterstate_key(mcts, hash, bag);
+    entries[k] = table_find(mcts, key);
+    visits[k] = entries[k] ? atomic_load(&entries[k]->visits) : 0;
+    if (visits[k] == 0) {
+      *entry = table_insert(mcts, key);
+      *expanded = true;
+      return order[k];
+    }
+    total += visits[k];
+  }
+
+  int best = -1;
+  double best_ucb = -DBL_MAX;
+  double log_total = log((double)total);
+  for (size_t k = 0; k < widen; k++) {
+    double mean = atomic_load(&entries[k]->value) / VALUE_ONE / visits[k];
+    double ucb = mean + MCTS_EXPLORATION * sqrt(log_total / visits[k]);
+    if (ucb > best_ucb) {
+      best_ucb = ucb;
+      best = order[k];
+      *entry = entries[k];
+    }
+  }
+  return best;
+}
+
+// The greedy bot's placement of piece, from the transposition table when
+// it's there. False when every placement tops out.
+static bool rollout_move(Mcts *mcts, size_t worker, const Row *board,
+                         uint64_t board_hash, Tetromino piece,
+                         Tetromino *placement) {
+  uint64_t key = 0;
+  Tt_Move move;
+  if (mcts->tt != NULL) {
+    key = tt_key(board_hash, piece);
+    if (tt_probe(mcts->tt, key, worker, &move)) {
+      *placement = move.placement;
+      return move.found;
+    }
+  }
+
+  Bot *bot = &mcts->bots[worker];
+  bot_evaluate(bot, board, piece);
+  int chosen = -1;
+  for (size_t i = 0; i < bot->count; i++) {
+    if (!bot->topped_out[i] &&
+        (chosen < 0 || bot->scores[i] > bot->scores[chosen]))
+      chosen = (int)i;
+  }
+  move = (Tt_Move){.found = chosen >= 0};
+  if (chosen >= 0) {
+    move.placement = bot->placements[chosen];
+    move.score = bot->scores[chosen];
+  }
+  if (mcts->tt != NULL)
+    tt_store(mcts->tt, key, worker, &move);
+  *placement = move.placement;
+  return move.found;
+}
+
+static void run_iteration(Mcts *mcts, size_t worker) {
+  Bot *bot = &mcts->bots[worker];
+  uint8_t sequence[MCTS_MAX_HORIZON];
+  sample_sequence(mcts, &mcts->rngs[worker], sequence);
+
+  Row board[BOARD_ROWS + 3];
+  memcpy(board, mcts->board, sizeof(board));
+  uint64_t board_hash = mcts->board_hash;
+  uint8_t bag = mcts->bag_left;
+  Mcts_Entry *path[MCTS_MAX_HORIZON];
+  size_t path_count = 0;
+  bool in_tree = true;
+  uint64_t parent_visits = atomic_fetch_add(&mcts->iteration_count, 1) + 1;
+  int pieces = 0, lines = 0;
+
+  for (size_t d = 0; d < mcts->horizon; d++) {
+    Tetromino piece = mcts->tetromino;
+    if (d > 0) {
+      if (bag == 0)
+        bag = ALL_TYPES;
+      bag &= ~(1 << sequence[d]);
+      piece = (Tetromino){.type = sequence[d]};
+      piece.pos.x = tet_spawn_x[piece.type];
+    }
+
+    Tetromino placement;
+    if (in_tree) {
+      bot_evaluate(bot, board, piece);
+      Mcts_Entry *entry;
+      bool expanded;
+      int chosen = select_child(mcts, bot, board, board_hash, bag,
+                                parent_visits, &entry, &expanded);
+      if (chosen < 0)
+        break;
+      if (entry != NULL) {
+        parent_visits = atomic_fetch_add(&entry->visits, 1) + 1;
+        path[path_count++] = entry;
+      }
+      in_tree = entry != NULL && !expanded;
+      placement = bot->placements[chosen];
+    } else if (!rollout_move(mcts, worker, board, board_hash, piece,
+                             &placement)) {
+      break;
+    }
+    board_hash = place(board, board_hash, placement, &lines);
+    pieces++;
+  }
+
+  // Surviving and clearing lines weigh the same, a piece adds 4 cells and
+  // a line takes BOARD_WIDTH
+  double value = (pieces + lines * BOARD_WIDTH / 4.0) / (2.0 * mcts->horizon);
+  if (value > 1)
+    value = 1;
+  uint64_t fixed = (uint64_t)(value * VALUE_ONE);
+  for (size_t i = 0; i < path_count; i++) {
+    atomic_fetch_add(&path[i]->value, fixed);
+  }
+}
+
+static void run_worker(void *context, size_t index, size_t worker) {
+  (void)index;
+  Mcts *mcts = context;
+  do {
+    run_iteration(mcts, worker);
+  } while (pool_seconds() < mcts->deadline);
+}
+
+bool mcts_choose(Mcts *mcts, const Row *board, Tetromino tetromino,
+                 const Tetromino *bag_left, size_t bag_left_count,
+                 Tetromino *best) {
+  double start = pool_seconds();
+  mcts->deadline = start + mcts->time_budget;
+  memset(mcts->table, 0, mcts->table_capacity * sizeof(Mcts_Entry));
+  atomic_store(&mcts->table_used, 0);
+  atomic_store(&mcts->iteration_count, 0);
+  if (mcts->tt != NULL)
+    tt_new_search(mcts->tt);
+
+  memcpy(mcts->board, board, sizeof(mcts->board));
+  mcts->board_hash = zobrist_board(mcts->board);
+  mcts->tetromino = tetromino;
+  mcts->bag_left = 0;
+  for (size_t i = 0; i < bag_left_count; i++) {
+    mcts->bag_left |= 1 << bag_left[i].type;
+  }
+
+  // Not a single placement, nothing to search
+  Bot *bot = &mcts->bots[0];
+  size_t count = bot_evaluate(bot, mcts->board, tetromino);
+  bool any = false;
+  for (size_t i = 0; i < count; i++) {
+    any |= !bot->topped_out[i];
+  }
+  if (!any) {
+    mcts->iterations = 0;
+    mcts->nodes = 0;
+    mcts->seconds = pool_seconds() - start;
+    return false;
+  }
+
+  pool_run(mcts->pool, run_worker, mcts, pool_worker_count(mcts->pool));
+
+  // The workers were using bot 0 too
+  count = bot_evaluate(bot, mcts->board, tetromino);
+  int chosen = -1;
+  unsigned chosen_visits = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (bot->topped_out[i])
+      continue;
+    Row child[BOARD_ROWS + 3];
+    memcpy(child, mcts->board, sizeof(child));
+    int lines = 0;
+    uint64_t hash =
+        place(child, mcts->board_hash, bot->placements[i], &lines);
+    Mcts_Entry *entry =
+        table_find(mcts, afterstate_key(mcts, hash, mcts->bag_left));
+    unsigned visits = entry ? atomic_load(&entry->visits) : 0;
+    // Ties, also when nothing got visited, go to the bot's favourite
+    if (chosen < 0 || visits > chosen_visits ||
+        (visits == chosen_visits && bot->scores[i] > bot->scores[chosen])) {
+      chosen = (int)i;
+      chosen_visits = visits;
+    }
+  }
+  *best = bot->placements[chosen];
+
+  mcts->iterations = atomic_load(&mcts->iteration_count);
+  mcts->nodes = atomic_load(&mcts->table_used);
+  mcts->seconds = pool_seconds() - start;
+  return true;
+}
+
+bool mcts_choose_game(Mcts *mcts, const Game_State *g, Tetromino *best) {
+  return mcts_choose(mcts, g->board, g->tetromino,
+                     g->tetromino_bag + g->tetromino_bag_used,
+                     7 - g->tetromino_bag_used, best);
+}
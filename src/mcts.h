@@ -0,0 +1,92 @@
+#ifndef MCTS_H_
+#define MCTS_H_
+
+// Monte Carlo tree search over the pieces nobody has seen yet. Only the
+// falling tetromino and which types are left in its 7-bag are known, so
+// every iteration samples an order for those types and full bags after
+// them, then walks the tree with UCT and finishes with a greedy rollout.
+//
+// The tree lives in one open addressing table shared by all pool workers. Its
+// entries are afterstates, a board together with the types left in the
+// bag, keyed by Zobrist hash. Workers claim slots with a compare and swap
+// and update the statistics with atomic adds, so nothing takes a lock.
+// Visits count on the way down, which keeps other workers off the path in
+// flight until its value comes back.
+//
+// Rollouts replay the greedy bot's decision on boards that come up again and
+// again. With a transposition table each is worked out once and looked up
+// after that.
+
+#include "bot.h"
+#include "game.h"
+#include "pool.h"
+#include "tt.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MCTS_MAX_HORIZON 64
+// One bag, longer rollouts cost more iterations than they tell
+#define MCTS_DEFAULT_HORIZON 7
+#define MCTS_DEFAULT_TABLE_BITS 18
+#define MCTS_DEFAULT_TIME_BUDGET 0.005
+#define MCTS_EXPLORATION 0.3f
+
+typedef struct {
+  // Afterstate hash, 0 while the slot is free
+  _Atomic uint64_t key;
+  atomic_uint visits;
+  // Sum of the values backed up through here, fixed point
+  _Atomic uint64_t value;
+} Mcts_Entry;
+
+typedef struct {
+  Pool *pool;
+  // NULL for none
+  Tt *tt;
+  Bot_Weights weights;
+  // Pieces an iteration plays, tree and rollout together
+  size_t horizon;
+  double time_budget;
+
+  // One of each per pool worker
+  Bot *bots;
+  Rng *rngs;
+
+  Mcts_Entry *table;
+  size_t table_capacity;
+  atomic_size_t table_used;
+  // Keys of the sets of types left in the bag
+  uint64_t bag_keys[1 << TET_TYPE_COUNT];
+
+  // The position being searched
+  Row board[BOARD_ROWS + 3];
+  uint64_t board_hash;
+  Tetromino tetromino;
+  uint8_t bag_left;
+  double deadline;
+  atomic_uint_fast64_t iteration_count;
+
+  // Statistics of the last search
+  uint64_t iterations;
+  size_t nodes;
+  double seconds;
+} Mcts;
+
+// Searches on pool and shares tt, if not NULL, with whoever else uses it.
+// Both must outlive the search. The tree's table holds 1 << table_bits
+// afterstates. False when out of memory.
+bool mcts_init(Mcts *mcts, Pool *pool, Tt *tt, const Bot_Weights *weights,
+               size_t table_bits, size_t horizon, double time_budget,
+               uint64_t seed);
+void mcts_free(Mcts *mcts);
+// The most visited placement of tetromino, false when it has nowhere to go.
+// bag_left are the types still in the bag after tetromino, in any order.
+bool mcts_choose(Mcts *mcts, const Row *board, Tetromino tetromino,
+                 const Tetromino *bag_left, size_t bag_left_count,
+                 Tetromino *best);
+// Searches the game's position, ignoring the order of the rest of its bag
+bool mcts_choose_game(Mcts *mcts, const Game_State *g, Tetromino *best);
+
+#endif // MCTS_H_
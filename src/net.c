@@ -0,0 +1,312 @@
+#include "net.h"
+#include <float.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+_Static_assert(sizeof(Net_Header) == NET_ALIGN, "Net_Header is one block");
+
+#define CELL_INPUTS (BOARD_ROWS * BOARD_WIDTH)
+
+static size_t align_up(size_t offset) {
+  return (offset + NET_ALIGN - 1) & ~(size_t)(NET_ALIGN - 1);
+}
+
+static bool map_file(Net *net, const char *path) {
+#if defined(_WIN32)
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+  LARGE_INTEGER size;
+  HANDLE mapping = NULL;
+  if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(file);
+  if (mapping == NULL)
+    return false;
+  net->data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (net->data == NULL) {
+    CloseHandle(mapping);
+    return false;
+  }
+  net->size = (size_t)size.QuadPart;
+  net->file_mapping = mapping;
+  return true;
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  void *data = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0)
+    data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return false;
+  net->data = data;
+  net->size = (size_t)st.st_size;
+  return true;
+#endif
+}
+
+void net_free(Net *net) {
+  if (net->data == NULL)
+    return;
+#if defined(_WIN32)
+  UnmapViewOfFile(net->data);
+  CloseHandle(net->file_mapping);
+#else
+  munmap(net->data, net->size);
+#endif
+  net->data = NULL;
+  net->size = 0;
+}
+
+// With every cell set and the heaviest type in every piece slot, no first
+// layer sum may leave int16, then the order of the adds doesn't matter
+static bool first_layer_fits(const Net *net) {
+  for (size_t j = 0; j < net->hidden1; j++) {
+    int64_t bound = net->bias1[j] < 0 ? -net->bias1[j] : net->bias1[j];
+    for (size_t i = 0; i < CELL_INPUTS; i++) {
+      int w = net->weights1[i * net->hidden1 + j];
+      bound += w < 0 ? -w : w;
+    }
+    for (size_t slot = 0; slot <= net->preview; slot++) {
+      int heaviest = 0;
+      for (size_t type = 0; type < TET_TYPE_COUNT; type++) {
+        size_t input = CELL_INPUTS + slot * TET_TYPE_COUNT + type;
+        int w = net->weights1[input * net->hidden1 + j];
+        if ((w < 0 ? -w : w) > heaviest)
+          heaviest = w < 0 ? -w : w;
+      }
+      bound += heaviest;
+    }
+    if (bound > INT16_MAX)
+      return false;
+  }
+  return true;
+}
+
+bool net_load(Net *net, const char *path) {
+  memset(net, 0, sizeof(*net));
+  if (!map_file(net, path))
+    return false;
+
+  Net_Header header;
+  if (net->size < sizeof(header)) {
+    net_free(net);
+    return false;
+  }
+  memcpy(&header, net->data, sizeof(header));
+  if (memcmp(header.magic, NET_MAGIC, 4) != 0 ||
+      header.version != NET_VERSION || header.board_width != BOARD_WIDTH ||
+      header.board_rows != BOARD_ROWS || header.preview > NET_MAX_PREVIEW ||
+      header.hidden1 == 0 || header.hidden1 > NET_MAX_HIDDEN1 ||
+      header.hidden1 % 32 != 0 || header.hidden2 == 0 ||
+      header.hidden2 > NET_MAX_HIDDEN2 || header.hidden2 % 8 != 0 ||
+      header.shift1 > 15 || header.shift2 > 30) {
+    net_free(net);
+    return false;
+  }
+  net->preview = header.preview;
+  net->inputs = CELL_INPUTS + (1 + header.preview) * TET_TYPE_COUNT;
+  net->hidden1 = header.hidden1;
+  net->hidden2 = header.hidden2;
+  net->shift1 = header.shift1;
+  net->shift2 = header.shift2;
+  net->output_scale = header.output_scale;
+
+  const uint8_t *base = net->data;
+  size_t offset = sizeof(header);
+  net->bias1 = (const int16_t *)(base + offset);
+  offset = align_up(offset + net->hidden1 * sizeof(int16_t));
+  net->weights1 = (const int8_t *)(base + offset);
+  offset = align_up(offset + net->inputs * net->hidden1);
+  net->bias2 = (const int32_t *)(base + offset);
+  offset = align_up(offset + net->hidden2 * sizeof(int32_t));
+  net->weights2 = (const int8_t *)(base + offset);
+  offset = align_up(offset + net->hidden2 * net->hidden1);
+  net->bias3 = (const int32_t *)(base + offset);
+  offset = align_up(offset + sizeof(int32_t));
+  net->weights3 = (const int8_t *)(base + offset);
+  offset += net->hidden2;
+  if (offset > net->size || !first_layer_fits(net)) {
+    net_free(net);
+    return false;
+  }
+  return true;
+}
+
+static void add_column(const Net *net, Net_Accumulator *acc, size_t input) {
+  const int8_t *column = net->weights1 + input * net->hidden1;
+#if defined(__AVX2__)
+  for (size_t i = 0; i < net->hidden1; i += 16) {
+    __m256i sum = _mm256_load_si256((const __m256i *)&acc->values[i]);
+    __m256i w = _mm256_cvtepi8_epi16(
+        _mm_loadu_si128((const __m128i *)&column[i]));
+    _mm256_store_si256((__m256i *)&acc->values[i], _mm256_add_epi16(sum, w));
+  }
+#else
+  for (size_t i = 0; i < net->hidden1; i++) {
+    acc->values[i] = (int16_t)(acc->values[i] + column[i]);
+  }
+#endif
+}
+
+void net_refresh(const Net *net, Net_Accumulator *acc, const Row *board,
+                 const Tetromino *pieces, size_t piece_count) {
+  memcpy(acc->values, net->bias1, net->hidden1 * sizeof(int16_t));
+  for (size_t y = 0; y < BOARD_ROWS; y++) {
+    for (Row row = board[y]; row; row &= row - 1) {
+      add_column(net, acc, y * BOARD_WIDTH + ROW_CTZ(row));
+    }
+  }
+  if (piece_count > 1 + net->preview)
+    piece_count = 1 + net->preview;
+  for (size_t k = 0; k < piece_count; k++) {
+    add_column(net, acc, CELL_INPUTS + k * TET_TYPE_COUNT + pieces[k].type);
+  }
+}
+
+void net_add_cells(const Net *net, Net_Accumulator *acc, Tetromino placement) {
+  const Cell *parts = tet_states[placement.type][placement.state];
+  for (size_t i = 0; i < 4; i++) {
+    int x = placement.pos.x + parts[i].x;
+    int y = placement.pos.y + parts[i].y;
+    add_column(net, acc, (size_t)y * BOARD_WIDTH + x);
+  }
+}
+
+static int32_t clip(int32_t sum, unsigned shift) {
+  if (sum <= 0)
+    return 0;
+  sum >>= shift;
+  return sum > 127 ? 127 : sum;
+}
+
+static float output_layer(const Net *net, const int32_t *h2) {
+  int32_t out = *net->bias3;
+  for (size_t j = 0; j < net->hidden2; j++) {
+    out += h2[j] * net->weights3[j];
+  }
+  return out * net->output_scale;
+}
+
+float net_output_scalar(const Net *net, const Net_Accumulator *acc) {
+  uint8_t h1[NET_MAX_HIDDEN1];
+  int32_t h2[NET_MAX_HIDDEN2];
+  for (size_t i = 0; i < net->hidden1; i++) {
+    h1[i] = (uint8_t)clip(acc->values[i], net->shift1);
+  }
+  for (size_t j = 0; j < net->hidden2; j++) {
+    const int8_t *row = net->weights2 + j * net->hidden1;
+    int32_t sum = 0;
+    for (size_t i = 0; i < net->hidden1; i++) {
+      sum += h1[i] * row[i];
+    }
+    h2[j] = clip(net->bias2[j] + sum, net->shift2);
+  }
+  return output_layer(net, h2);
+}
+
+float net_output(const Net *net, const Net_Accumulator *acc) {
+#if defined(__AVX2__)
+  _Alignas(32) uint8_t h1[NET_MAX_HIDDEN1];
+  int32_t h2[NET_MAX_HIDDEN2];
+  __m128i shift1 = _mm_cvtsi32_si128((int)net->shift1);
+  __m256i zero = _mm256_setzero_si256();
+  __m256i top = _mm256_set1_epi16(127);
+  for (size_t i = 0; i < net->hidden1; i += 32) {
+    __m256i a = _mm256_load_si256((const __m256i *)&acc->values[i]);
+    __m256i b = _mm256_load_si256((const __m256i *)&acc->values[i + 16]);
+    a = _mm256_min_epi16(_mm256_sra_epi16(_mm256_max_epi16(a, zero), shift1),
+                         top);
+    b = _mm256_min_epi16(_mm256_sra_epi16(_mm256_max_epi16(b, zero), shift1),
+                         top);
+    // The pack works within 128 bit halves, put them back in order
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b),
+                                              _MM_SHUFFLE(3, 1, 2, 0));
+    _mm256_store_si256((__m256i *)&h1[i], packed);
+  }
+  __m256i ones = _mm256_set1_epi16(1);
+  for (size_t j = 0; j < net->hidden2; j++) {
+    const int8_t *row = net->weights2 + j * net->hidden1;
+    __m256i sum = _mm256_setzero_si256();
+    for (size_t i = 0; i < net->hidden1; i += 32) {
+      // Pairs of at most 127 * 128 * 2, maddubs can't saturate
+      __m256i products = _mm256_maddubs_epi16(
+          _mm256_load_si256((const __m256i *)&h1[i]),
+          _mm256_loadu_si256((const __m256i *)&row[i]));
+      sum = _mm256_add_epi32(sum, _mm256_madd_epi16(products, ones));
+    }
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum),
+                                 _mm256_extracti128_si256(sum, 1));
+    half = _mm_add_epi32(half,
+                         _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+    half = _mm_add_epi32(half,
+                         _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+    h2[j] = clip(net->bias2[j] + _mm_cvtsi128_si32(half), net->shift2);
+  }
+  return output_layer(net, h2);
+#else
+  return net_output_scalar(net, acc);
+#endif
+}
+
+float net_evaluate(const Net *net, const Row *board, const Tetromino *pieces,
+                   size_t piece_count) {
+  Net_Accumulator acc;
+  net_refresh(net, &acc, board, pieces, piece_count);
+  return net_output(net, &acc);
+}
+
+void net_score_placements(const Net *net, Bot *bot, const Row *board,
+                          const Tetromino *preview, size_t preview_count) {
+  Net_Accumulator base, acc;
+  net_refresh(net, &base, board, preview, preview_count);
+  for (size_t i = 0; i < bot->count; i++) {
+    if (bot->topped_out[i])
+      continue;
+    if (bot->lines[i] == 0) {
+      memcpy(acc.values, base.values, net->hidden1 * sizeof(int16_t));
+      net_add_cells(net, &acc, bot->placements[i]);
+    } else {
+      // Cleared rows move every cell above them, start over
+      Row after[BOARD_ROWS + 3];
+      memcpy(after, board, sizeof(after));
+      board_add_tetromino(after, bot->placements[i]);
+      board_clear_rows(after, board_full_rows(after));
+      net_refresh(net, &acc, after, preview, preview_count);
+    }
+    bot->scores[i] = bot->lines[i] + net_output(net, &acc);
+  }
+}
+
+bool net_choose(const Net *net, Bot *bot, const Row *board,
+                Tetromino tetromino, const Tetromino *preview,
+                size_t preview_count, Tetromino *best) {
+  size_t count = bot_evaluate(bot, board, tetromino);
+  net_score_placements(net, bot, board, preview, preview_count);
+  int chosen = -1;
+  for (size_t i = 0; i < count; i++) {
+    if (!bot->topped_out[i] &&
+        (chosen < 0 || bot->scores[i] > bot->scores[chosen]))
+      chosen = (int)i;
+  }
+  if (chosen < 0)
+    return false;
+  *best = bot->placements[chosen];
+  return true;
+}
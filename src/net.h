@@ -0,0 +1,118 @@
+#ifndef NET_H_
+#define NET_H_
+
+// Learned board evaluator, a small int8 quantised network that values a
+// position: the board, the piece to place and the pieces after it.
+//
+// The inputs are binary: one per board cell, row after row from the top
+// hidden row, then one of seven for the piece's type, then one of seven for
+// each preview piece. So the first layer is a sum of the weight columns of
+// the inputs that are set, kept as an accumulator that a placement updates
+// with its four cells instead of recomputing. The rest are dense layers of
+// int8 weights on uint8 activations, clipped to 0..127, which AVX2 (build
+// with -native) multiplies 32 at a time. Without AVX2 a scalar path
+// computes the same integers.
+//
+// Weights are memory mapped from a file, little endian:
+//
+//   Net_Header, then at 64 byte aligned offsets:
+//   int16 bias1[hidden1]
+//   int8  weights1[inputs][hidden1]
+//   int32 bias2[hidden2]
+//   int8  weights2[hidden2][hidden1]
+//   int32 bias3
+//   int8  weights3[hidden2]
+//
+//   h1 = min(max(bias1 + sum of weights1 of set inputs, 0) >> shift1, 127)
+//   h2 = min(max(bias2 + weights2 * h1, 0) >> shift2, 127)
+//   value = (bias3 + weights3 * h2) * output_scale
+//
+// The value is in cleared lines still to come, so a placement scores the
+// lines it clears plus the value of the position after it.
+
+#include "bot.h"
+#include "game.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define NET_MAGIC "TNET"
+#define NET_VERSION 1
+#define NET_MAX_PREVIEW 6
+#define NET_MAX_HIDDEN1 1024
+#define NET_MAX_HIDDEN2 64
+#define NET_ALIGN 64
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  // Must match the build's board
+  uint32_t board_width;
+  uint32_t board_rows;
+  // Preview pieces after the one to place
+  uint32_t preview;
+  // Multiples of 32 and 8
+  uint32_t hidden1;
+  uint32_t hidden2;
+  uint32_t shift1;
+  uint32_t shift2;
+  float output_scale;
+  uint32_t reserved[6];
+} Net_Header;
+
+typedef struct {
+  // The mapping, unmapped by net_free
+  void *data;
+  size_t size;
+  void *file_mapping;
+
+  size_t inputs;
+  size_t preview;
+  size_t hidden1;
+  size_t hidden2;
+  unsigned shift1;
+  unsigned shift2;
+  float output_scale;
+  const int16_t *bias1;
+  const int8_t *weights1;
+  const int32_t *bias2;
+  const int8_t *weights2;
+  const int32_t *bias3;
+  const int8_t *weights3;
+} Net;
+
+// First layer sums, before clipping
+typedef struct {
+  _Alignas(32) int16_t values[NET_MAX_HIDDEN1];
+} Net_Accumulator;
+
+// Maps the network in path. False when it can't be read, isn't a network
+// for this board size or its first layer could overflow 16 bits.
+bool net_load(Net *net, const char *path);
+void net_free(Net *net);
+
+// The accumulator of a position. pieces are the piece to place and the
+// preview, only the first 1 + net->preview count.
+void net_refresh(const Net *net, Net_Accumulator *acc, const Row *board,
+                 const Tetromino *pieces, size_t piece_count);
+// Adds the cells of a locked piece, as long as no row gets cleared
+void net_add_cells(const Net *net, Net_Accumulator *acc, Tetromino placement);
+float net_output(const Net *net, const Net_Accumulator *acc);
+// net_output without AVX2 in any build, to check the AVX2 path against
+float net_output_scalar(const Net *net, const Net_Accumulator *acc);
+float net_evaluate(const Net *net, const Row *board, const Tetromino *pieces,
+                   size_t piece_count);
+
+// Rescores the placements bot_evaluate left in bot: the lines each clears
+// plus the value of the board after it, with preview[0] the next piece to
+// place. Topped out placements keep -FLT_MAX. board must hold
+// BOARD_ROWS + 3 rows like Game_State.board, as it's copied whole to place
+// each piece, and so must net_choose's.
+void net_score_placements(const Net *net, Bot *bot, const Row *board,
+                          const Tetromino *preview, size_t preview_count);
+// Like bot_choose, with the placements scored by the network
+bool net_choose(const Net *net, Bot *bot, const Row *board,
+                Tetromino tetromino, const Tetromino *preview,
+                size_t preview_count, Tetromino *best);
+
+#endif // NET_H_
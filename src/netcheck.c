@@ -0,0 +1,195 @@
+// netcheck: writes a network of random weights in the format of src/net.h
+// and checks the evaluator on it.
+//
+//   ./build/netcheck [path] [pieces] [seed]
+//
+// First a network whose first layer could overflow 16 bits is written to
+// path and net_load has to refuse it. Then path gets a random network that
+// fits and the greedy bot plays pieces pieces, starting over when it tops
+// out. At every position net_choose values the placements, timed, and each
+// one that clears no rows must give the same accumulator through
+// net_add_cells as through net_refresh of the board after it. net_output
+// must give exactly what net_output_scalar does, which tests the AVX2 path
+// in a -native build. botbench times whole games with the file as its net.
+
+#include "args.h"
+#include "bot.h"
+#include "game.h"
+#include "net.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define HIDDEN1 256
+#define HIDDEN2 32
+#define CELL_INPUTS (BOARD_ROWS * BOARD_WIDTH)
+
+static size_t align_up(size_t offset) {
+  return (offset + NET_ALIGN - 1) & ~(size_t)(NET_ALIGN - 1);
+}
+
+static int random_in(Rng *rng, int low, int high) {
+  return low + (int)rng_below(rng, (uint32_t)(high - low + 1));
+}
+
+// Small enough weights that no first layer sum leaves 16 bits, unless
+// overflow puts the first bias at its limit
+static bool write_network(const char *path, bool overflow, Rng *rng) {
+  Net_Header header = {
+      .magic = NET_MAGIC,
+      .version = NET_VERSION,
+      .board_width = BOARD_WIDTH,
+      .board_rows = BOARD_ROWS,
+      .preview = NET_MAX_PREVIEW,
+      .hidden1 = HIDDEN1,
+      .hidden2 = HIDDEN2,
+      .shift1 = 3,
+      .shift2 = 8,
+      .output_scale = 1.0f / 64,
+  };
+  size_t inputs = CELL_INPUTS + (1 + NET_MAX_PREVIEW) * TET_TYPE_COUNT;
+  size_t bias1 = sizeof(header);
+  size_t weights1 = align_up(bias1 + HIDDEN1 * sizeof(int16_t));
+  size_t bias2 = align_up(weights1 + inputs * HIDDEN1);
+  size_t weights2 = align_up(bias2 + HIDDEN2 * sizeof(int32_t));
+  size_t bias3 = align_up(weights2 + HIDDEN2 * HIDDEN1);
+  size_t weights3 = align_up(bias3 + sizeof(int32_t));
+  size_t size = weights3 + HIDDEN2;
+  uint8_t *data = calloc(size, 1);
+  if (data == NULL)
+    return false;
+
+  memcpy(data, &header, sizeof(header));
+  for (size_t j = 0; j < HIDDEN1; j++) {
+    int16_t bias = (int16_t)random_in(rng, -256, 256);
+    if (overflow && j == 0)
+      bias = INT16_MAX;
+    memcpy(data + bias1 + j * sizeof(bias), &bias, sizeof(bias));
+  }
+  for (size_t i = 0; i < inputs; i++) {
+    // The biases and the pieces stay below 1024
+    int limit = i < CELL_INPUTS ? (INT16_MAX - 1024) / CELL_INPUTS : 64;
+    for (size_t j = 0; j < HIDDEN1; j++) {
+      data[weights1 + i * HIDDEN1 + j] =
+          (uint8_t)random_in(rng, -limit, limit);
+    }
+  }
+  for (size_t j = 0; j < HIDDEN2; j++) {
+    int32_t bias = random_in(rng, -4096, 4096);
+    memcpy(data + bias2 + j * sizeof(bias), &bias, sizeof(bias));
+  }
+  for (size_t i = 0; i < HIDDEN2 * HIDDEN1; i++) {
+    data[weights2 + i] = (uint8_t)random_in(rng, -128, 127);
+  }
+  int32_t bias = random_in(rng, -1024, 1024);
+  memcpy(data + bias3, &bias, sizeof(bias));
+  for (size_t j = 0; j < HIDDEN2; j++) {
+    data[weights3 + j] = (uint8_t)random_in(rng, -128, 127);
+  }
+
+  FILE *f = fopen(path, "wb");
+  bool ok = f != NULL && fwrite(data, 1, size, f) == size;
+  if (f != NULL && fclose(f) != 0)
+    ok = false;
+  free(data);
+  return ok;
+}
+
+// The placements of bot's last bot_evaluate, checked one by one
+static bool check_position(const Net *net, const Bot *bot, const Row *board,
+                           const Tetromino *preview, size_t preview_count) {
+  Net_Accumulator base, added, refreshed;
+  net_refresh(net, &base, board, preview, preview_count);
+  for (size_t i = 0; i < bot->count; i++) {
+    if (bot->topped_out[i] || bot->lines[i] != 0)
+      continue;
+    memcpy(added.values, base.values, net->hidden1 * sizeof(int16_t));
+    net_add_cells(net, &added, bot->placements[i]);
+    Row after[BOARD_ROWS + 3];
+    memcpy(after, board, sizeof(after));
+    board_add_tetromino(after, bot->placements[i]);
+    net_refresh(net, &refreshed, after, preview, preview_count);
+    if (memcmp(added.values, refreshed.values,
+               net->hidden1 * sizeof(int16_t)) != 0) {
+      fprintf(stderr, "net_add_cells differs from net_refresh\n");
+      return false;
+    }
+    float output = net_output(net, &added);
+    float scalar = net_output_scalar(net, &added);
+    if (output != scalar) {
+      fprintf(stderr, "net_output %f, the scalar path %f\n", output, scalar);
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  const char *path = "build/random.tnet";
+  uint64_t max_pieces = 1000, seed = 1;
+  if (argc > 4 || (argc > 1 && !arg_name(path = argv[1])) ||
+      (argc > 2 && !arg_count(argv[2], &max_pieces)) ||
+      (argc > 3 && !arg_count(argv[3], &seed))) {
+    fprintf(stderr, "Usage: %s [path] [pieces] [seed]\n", argv[0]);
+    return 1;
+  }
+  Rng rng;
+  rng_seed(&rng, seed);
+
+  Net net;
+  if (!write_network(path, true, &rng)) {
+    fprintf(stderr, "Can't write %s\n", path);
+    return 1;
+  }
+  if (net_load(&net, path)) {
+    fprintf(stderr, "net_load took a network that can overflow\n");
+    net_free(&net);
+    return 1;
+  }
+  if (!write_network(path, false, &rng) || !net_load(&net, path)) {
+    fprintf(stderr, "Can't write and load %s\n", path);
+    return 1;
+  }
+
+  Bot bot;
+  bot_init(&bot, &bot_default_weights);
+  Game_State g;
+  game_init(&g, seed);
+  // positions counts the placements net_choose valued
+  uint64_t pieces = 0, positions = 0;
+  double seconds = 0;
+  bool ok = true;
+  while (ok && pieces < max_pieces) {
+    const Tetromino *preview = g.tetromino_bag + g.tetromino_bag_used;
+    size_t preview_count = 7 - g.tetromino_bag_used;
+    Tetromino best;
+    clock_t start = clock();
+    bool found = net_choose(&net, &bot, g.board, g.tetromino, preview,
+                            preview_count, &best);
+    seconds += (double)(clock() - start) / CLOCKS_PER_SEC;
+    positions += bot.count;
+    ok = found && check_position(&net, &bot, g.board, preview, preview_count);
+    // The random network would top out at once, the bot plays on
+    if (!bot_choose(&bot, g.board, g.tetromino, &best) ||
+        game_place(&g, best) < 0)
+      game_init(&g, ++seed);
+    pieces++;
+  }
+  net_free(&net);
+  if (!ok)
+    return 1;
+
+#if defined(__AVX2__)
+  const char *path_name = "AVX2";
+#else
+  const char *path_name = "scalar";
+#endif
+  printf("%s: overflow rejected, %llu pieces, %llu placements checked, "
+         "%s net_output matches the scalar path\n",
+         path, (unsigned long long)pieces, (unsigned long long)positions,
+         path_name);
+  printf("%.3f us per placement in net_choose\n",
+         positions ? seconds * 1e6 / positions : 0.0);
+  return 0;
+}
@@ -0,0 +1,176 @@
+// perft: counts the game states reachable after each of the first N pieces
+// of a seeded game, the way chess engines validate and time their move
+// generators.
+//
+//   ./build/perft <pieces> [seed]
+//
+// Every level expands each distinct board by every placement of the next
+// piece from the bag, then merges boards that hash the same. "nodes" counts
+// placement sequences like chess perft, "distinct" the boards they end in.
+// Placements that top out end the game and aren't counted. The last line
+// gives the distinct boards after the last piece, the nodes of all levels
+// and nodes per second, the figure chess engines quote. As merged boards
+// carry their path counts, nodes can grow faster than the work done, so the
+// move generator's own speed follows in placements generated per second.
+
+#include "args.h"
+#include "game.h"
+#include "placements.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+  Row board[BOARD_ROWS + 3];
+  uint64_t hash;
+  // Placement sequences that end in this board
+  uint64_t paths;
+} Node;
+
+typedef struct {
+  Node *items;
+  size_t count;
+  size_t capacity;
+
+  // Open addressing from board hash to index + 1, 0 is empty
+  uint32_t *index;
+  size_t index_capacity;
+} Level;
+
+static bool level_reserve(Level *level, size_t count) {
+  if (count > level->capacity) {
+    size_t capacity = level->capacity ? level->capacity : 1024;
+    while (capacity < count)
+      capacity *= 2;
+    Node *items = realloc(level->items, capacity * sizeof(Node));
+    if (items == NULL)
+      return false;
+    level->items = items;
+    level->capacity = capacity;
+  }
+  // Keep the index at most half full
+  if (count * 2 > level->index_capacity) {
+    size_t capacity = level->index_capacity ? level->index_capacity : 2048;
+    while (capacity < count * 2)
+      capacity *= 2;
+    uint32_t *index = calloc(capacity, sizeof(uint32_t));
+    if (index == NULL)
+      return false;
+    free(level->index);
+    level->index = index;
+    level->index_capacity = capacity;
+    for (size_t i = 0; i < level->count; i++) {
+      size_t slot = level->items[i].hash & (capacity - 1);
+      while (index[slot])
+        slot = (slot + 1) & (capacity - 1);
+      index[slot] = i + 1;
+    }
+  }
+  return true;
+}
+
+static void level_clear(Level *level) {
+  level->count = 0;
+  if (level->index)
+    memset(level->index, 0, level->index_capacity * sizeof(uint32_t));
+}
+
+// Adds paths to the node with this board, creating it if needed
+static bool level_add(Level *level, const Row *board, uint64_t hash,
+                      uint64_t paths) {
+  if (!level_reserve(level, level->count + 1))
+    return false;
+  size_t mask = level->index_capacity - 1;
+  size_t slot = hash & mask;
+  while (level->index[slot]) {
+    Node *node = &level->items[level->index[slot] - 1];
+    if (node->hash == hash) {
+      node->paths += paths;
+      return true;
+    }
+    slot = (slot + 1) & mask;
+  }
+  Node *node = &level->items[level->count++];
+  memcpy(node->board, board, sizeof(node->board));
+  node->hash = hash;
+  node->paths = paths;
+  level->index[slot] = level->count;
+  return true;
+}
+
+int main(int argc, char **argv) {
+  uint64_t depth, seed = 0;
+  if (argc < 2 || argc > 3 || !arg_count(argv[1], &depth) ||
+      (argc > 2 && !arg_count(argv[2], &seed))) {
+    fprintf(stderr, "Usage: %s <pieces> [seed]\n", argv[0]);
+    return 1;
+  }
+
+  Game_State g;
+  game_init(&g, seed);
+  Tetromino tetromino = g.tetromino;
+
+  Level levels[2] = {0};
+  Level *level = &levels[0], *next = &levels[1];
+  if (!level_add(level, g.board, zobrist_board(g.board), 1)) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+
+  static Tetromino placements[MAX_PLACEMENTS];
+  uint64_t generated = 0, total_nodes = 0;
+  clock_t start = clock();
+  for (uint64_t d = 1; d <= depth; d++) {
+    level_clear(next);
+    uint64_t nodes = 0;
+    for (size_t i = 0; i < level->count; i++) {
+      const Node *node = &level->items[i];
+      size_t count = generate_placements(node->board, tetromino, placements);
+      generated += count;
+      for (size_t p = 0; p < count; p++) {
+        Row board[BOARD_ROWS + 3];
+        memcpy(board, node->board, sizeof(board));
+        uint64_t hash = node->hash ^ board_add_tetromino(board, placements[p]);
+        if (board[BOARD_HEIGHT_EXTRA])
+          continue;
+        Column full = board_full_rows(board);
+        if (full) {
+          board_clear_rows(board, full);
+          hash = zobrist_board(board);
+        }
+        if (!level_add(next, board, hash, node->paths)) {
+          fprintf(stderr, "Out of memory at %llu pieces\n",
+                  (unsigned long long)d);
+          return 1;
+        }
+        nodes += node->paths;
+      }
+    }
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    printf("%2llu %c: %14llu nodes %12zu distinct %10.3fs\n",
+           (unsigned long long)d, TET_TYPE_NAMES[tetromino.type],
+           (unsigned long long)nodes, next->count, seconds);
+    fflush(stdout);
+    total_nodes += nodes;
+
+    Level *t = level;
+    level = next;
+    next = t;
+    tetromino = game_next_tetromino(&g);
+  }
+
+  double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+  printf("%zu distinct, %llu nodes in %.3fs, %.0f nodes/s, "
+         "%llu placements, %.0f placements/s\n",
+         level->count, (unsigned long long)total_nodes, seconds,
+         seconds > 0 ? total_nodes / seconds : 0.0,
+         (unsigned long long)generated,
+         seconds > 0 ? generated / seconds : 0.0);
+
+  for (size_t i = 0; i < 2; i++) {
+    free(levels[i].items);
+    free(levels[i].index);
+  }
+  return 0;
+}
@@ -0,0 +1,91 @@
+#include "placements.h"
+
+// The search keeps one Row per state and board row in which bit b stands for
+// pos.x = b - tet_boxes[type][state].left, so every position where the state
+// fits inside the walls has a bit, even on a 64 column board.
+
+// Positions where the state doesn't collide with board in row y
+static Row free_positions(const Row *board, int type, int state, int y) {
+  const Tet_Box *box = &tet_boxes[type][state];
+  if (y + box->top < 0 || y + box->bottom >= BOARD_ROWS)
+    return 0;
+  const Cell *parts = tet_states[type][state];
+  Row blocked = 0;
+  for (size_t i = 0; i < 4; i++) {
+    blocked |= board[y + parts[i].y] >> (parts[i].x - box->left);
+  }
+  return ~blocked & (FULL_ROW >> (box->right - box->left));
+}
+
+// Every free position connected to one in seeds by sideways moves
+static Row fill_sideways(Row seeds, Row free) {
+  Row left = seeds & free, right = left;
+  Row left_free = free, right_free = free;
+  for (int shift = 1; shift < BOARD_WIDTH; shift *= 2) {
+    left |= left_free & (Row)(left >> shift);
+    left_free &= left_free >> shift;
+    right |= right_free & (Row)(right << shift);
+    right_free &= (Row)(right_free << shift);
+  }
+  return left | right;
+}
+
+// Moves the bits of one state's row to where the same pos.x sits in another
+static Row shift_state(Row row, int from_left, int to_left) {
+  return to_left >= from_left ? (Row)(row << (to_left - from_left))
+                              : (Row)(row >> (from_left - to_left));
+}
+
+size_t generate_placements(const Row *board, Tetromino tetromino,
+                           Tetromino placements[MAX_PLACEMENTS]) {
+  int type = tetromino.type;
+  int states = tet_state_count[type];
+  int left[TET_MAX_STATES];
+  Row free[TET_MAX_STATES], reach[TET_MAX_STATES] = {0};
+  for (int s = 0; s < states; s++) {
+    left[s] = tet_boxes[type][s].left;
+    free[s] = free_positions(board, type, s, tetromino.pos.y);
+  }
+
+  int start = tetromino.pos.x + left[tetromino.state];
+  if (start < 0 || start >= BOARD_WIDTH ||
+      !(free[tetromino.state] & COLUMN_BIT(start)))
+    return 0;
+  reach[tetromino.state] = COLUMN_BIT(start);
+
+  size_t count = 0;
+  for (int y = tetromino.pos.y; y < BOARD_ROWS; y++) {
+    // Sideways moves and rotations within the row until nothing new turns up
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (int s = 0; s < states; s++) {
+        reach[s] = fill_sideways(reach[s], free[s]);
+        int next = tet_next_state[type][s];
+        Row rotated = shift_state(reach[s], left[s], left[next]) & free[next];
+        if (rotated & ~reach[next]) {
+          reach[next] |= rotated;
+          changed = true;
+        }
+      }
+    }
+
+    // Whatever can't fall to the next row locks here, the rest falls. The
+    // generated states all have different shapes, so no two placements
+    // cover the same cells.
+    Row falling = 0;
+    for (int s = 0; s < states; s++) {
+      Row below = free_positions(board, type, s, y + 1);
+      for (Row locked = reach[s] & ~below; locked; locked &= locked - 1) {
+        placements[count++] = (Tetromino){
+            .pos = {ROW_CTZ(locked) - left[s], y}, .type = type, .state = s};
+      }
+      reach[s] &= below;
+      free[s] = below;
+      falling |= reach[s];
+    }
+    if (!falling)
+      break;
+  }
+  return count;
+}
@@ -0,0 +1,21 @@
+#ifndef PLACEMENTS_H_
+#define PLACEMENTS_H_
+
+// Move generation for bots and analysis tools: every position a tetromino can
+// lock in, reached only the way game_step lets the player move it. That is
+// sideways, down and rotating in place without kicks, so tucks under
+// overhangs and spins into holes are included.
+
+#include "game.h"
+#include <stddef.h>
+
+// A tetromino never has more reachable locked positions than this
+#define MAX_PLACEMENTS (TET_MAX_STATES * BOARD_WIDTH * BOARD_ROWS)
+
+// Writes every locked position reachable from tetromino to placements and
+// returns how many there are, 0 when tetromino already collides. Each one
+// covers different cells, ordered top to bottom.
+size_t generate_placements(const Row *board, Tetromino tetromino,
+                           Tetromino placements[MAX_PLACEMENTS]);
+
+#endif // PLACEMENTS_H_
@@ -0,0 +1,315 @@
+#include "pool.h"
+
+#include <sched.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+// A job packs its loop's slot and the range of items it covers
+#define JOB_RANGE_BITS 28
+#define JOB_RANGE_MASK (((uint64_t)1 << JOB_RANGE_BITS) - 1)
+#define JOB_MAX_ITEMS ((size_t)JOB_RANGE_MASK)
+#define DEQUE_MASK (POOL_DEQUE_SIZE - 1)
+// Rounds a worker looks for jobs before it goes to sleep
+#define IDLE_ROUNDS 64
+
+// The pool the current thread works in and its worker number there
+static _Thread_local Pool *current_pool = NULL;
+static _Thread_local size_t current_worker = 0;
+
+double pool_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+size_t pool_default_threads(void) {
+#if defined(_WIN32)
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  long processors = (long)info.dwNumberOfProcessors;
+#else
+  long processors = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  if (processors <= 1)
+    return 0;
+  if (processors - 1 > POOL_MAX_THREADS)
+    return POOL_MAX_THREADS;
+  return (size_t)(processors - 1);
+}
+
+static uint64_t job_make(size_t loop, size_t begin, size_t end) {
+  return (uint64_t)loop << (2 * JOB_RANGE_BITS) |
+         (uint64_t)begin << JOB_RANGE_BITS | (uint64_t)end;
+}
+
+// Owner only. False when the deque is full.
+static bool deque_push(Pool_Deque *deque, uint64_t job) {
+  int_fast64_t bottom =
+      atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+  int_fast64_t top = atomic_load(&deque->top);
+  if (bottom - top >= POOL_DEQUE_SIZE)
+    return false;
+  atomic_store_explicit(&deque->jobs[bottom & DEQUE_MASK], job,
+                        memory_order_relaxed);
+  // Publishes the job to the thieves
+  atomic_store(&deque->bottom, bottom + 1);
+  return true;
+}
+
+// Owner only, takes the newest job
+static bool deque_pop(Pool_Deque *deque, uint64_t *job) {
+  int_fast64_t bottom =
+      atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+  atomic_store(&deque->bottom, bottom);
+  int_fast64_t top = atomic_load(&deque->top);
+  if (top > bottom) {
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    return false;
+  }
+  *job = atomic_load_explicit(&deque->jobs[bottom & DEQUE_MASK],
+                              memory_order_relaxed);
+  if (top < bottom)
+    return true;
+  // The last job, thieves may be after it too
+  bool won = atomic_compare_exchange_strong(&deque->top, &top, top + 1);
+  atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+  return won;
+}
+
+// Any thread, takes the oldest job. Also false when another thief won it.
+static bool deque_steal(Pool_Deque *deque, uint64_t *job) {
+  int_fast64_t top = atomic_load(&deque->top);
+  int_fast64_t bottom = atomic_load(&deque->bottom);
+  if (top >= bottom)
+    return false;
+  *job = atomic_load_explicit(&deque->jobs[top & DEQUE_MASK],
+                              memory_order_relaxed);
+  return atomic_compare_exchange_strong(&deque->top, &top, top + 1);
+}
+
+static bool any_jobs(Pool *pool) {
+  for (size_t i = 0; i <= pool->thread_count; i++) {
+    if (atomic_load(&pool->deques[i].top) <
+        atomic_load(&pool->deques[i].bottom))
+      return true;
+  }
+  return false;
+}
+
+static void wake_sleepers(Pool *pool) {
+  if (atomic_load(&pool->sleeping) == 0)
+    return;
+  pthread_mutex_lock(&pool->mutex);
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->mutex);
+}
+
+static bool find_job(Pool *pool, size_t worker, uint64_t *rng,
+                     uint64_t *job) {
+  if (deque_pop(&pool->deques[worker], job))
+    return true;
+  size_t workers = pool->thread_count + 1;
+  // xorshift, so thieves don't all line up behind the same victim
+  *rng ^= *rng << 13;
+  *rng ^= *rng >> 7;
+  *rng ^= *rng << 17;
+  size_t start = *rng % workers;
+  for (size_t i = 0; i < workers; i++) {
+    size_t victim = (start + i) % workers;
+    if (victim == worker)
+      continue;
+    if (deque_steal(&pool->deques[victim], job)) {
+      atomic_fetch_add_explicit(&pool->steals, 1, memory_order_relaxed);
+      return true;
+    }
+  }
+  return false;
+}
+
+static void run_job(Pool *pool, size_t worker, uint64_t job) {
+  size_t slot = job >> (2 * JOB_RANGE_BITS);
+  size_t begin = (job >> JOB_RANGE_BITS) & JOB_RANGE_MASK;
+  size_t end = job & JOB_RANGE_MASK;
+  Pool_Loop *loop = &pool->loops[slot];
+  Pool_Task task = loop->task;
+  void *context = loop->context;
+  size_t first = loop->first;
+
+  // Leave the upper half for thieves, down to a single item
+  while (end - begin > 1) {
+    size_t middle = begin + (end - begin) / 2;
+    if (!deque_push(&pool->deques[worker], job_make(slot, middle, end)))
+      break;
+    wake_sleepers(pool);
+    end = middle;
+  }
+  for (size_t i = begin; i < end; i++) {
+    task(context, first + i, worker);
+  }
+  atomic_fetch_sub(&loop->pending, end - begin);
+}
+
+static void *worker_main(void *arg) {
+  Pool_Worker *worker = arg;
+  Pool *pool = worker->pool;
+  current_pool = pool;
+  current_worker = worker->index;
+  uint64_t rng = 0x9E3779B97F4A7C15ull * (worker->index + 1);
+  size_t idle = 0;
+  while (!atomic_load(&pool->stop)) {
+    uint64_t job;
+    if (find_job(pool, worker->index, &rng, &job)) {
+      run_job(pool, worker->index, job);
+      idle = 0;
+      continue;
+    }
+    if (++idle < IDLE_ROUNDS) {
+      sched_yield();
+      continue;
+    }
+
+    // Pushers look at sleeping after publishing a job, so either they see
+    // this worker asleep or it sees their job
+    pthread_mutex_lock(&pool->mutex);
+    atomic_fetch_add(&pool->sleeping, 1);
+    while (!atomic_load(&pool->stop) && !any_jobs(pool)) {
+      pthread_cond_wait(&pool->wake, &pool->mutex);
+    }
+    atomic_fetch_sub(&pool->sleeping, 1);
+    pthread_mutex_unlock(&pool->mutex);
+    idle = 0;
+  }
+  return NULL;
+}
+
+static void stop_workers(Pool *pool, size_t started) {
+  atomic_store(&pool->stop, true);
+  pthread_mutex_lock(&pool->mutex);
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->mutex);
+  for (size_t i = 0; i < started; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+}
+
+void pool_init(Pool *pool, size_t threads) {
+  if (threads > POOL_MAX_THREADS)
+    threads = POOL_MAX_THREADS;
+  pool->thread_count = 0;
+  pool->deques = NULL;
+  for (size_t i = 0; i < POOL_MAX_LOOPS; i++) {
+    pool->loops[i].task = NULL;
+    pool->loops[i].context = NULL;
+    pool->loops[i].first = 0;
+    atomic_init(&pool->loops[i].pending, 0);
+    atomic_init(&pool->loops[i].used, false);
+  }
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->wake, NULL);
+  atomic_init(&pool->sleeping, 0);
+  atomic_init(&pool->stop, false);
+  atomic_init(&pool->steals, 0);
+  if (threads == 0)
+    return;
+
+  pool->deques = malloc((threads + 1) * sizeof(Pool_Deque));
+  if (pool->deques == NULL)
+    return;
+  for (size_t i = 0; i <= threads; i++) {
+    atomic_init(&pool->deques[i].top, 0);
+    atomic_init(&pool->deques[i].bottom, 0);
+  }
+  // Workers steal from every deque, so their number is set before the
+  // first one starts
+  pool->thread_count = threads;
+  for (size_t i = 0; i < threads; i++) {
+    Pool_Worker *worker = &pool->workers[i];
+    worker->pool = pool;
+    worker->index = i + 1;
+    if (pthread_create(&pool->threads[i], NULL, worker_main, worker) != 0) {
+      // Run everything on the caller rather than steal from dead deques
+      stop_workers(pool, i);
+      pool->thread_count = 0;
+      return;
+    }
+  }
+}
+
+void pool_free(Pool *pool) {
+  stop_workers(pool, pool->thread_count);
+  pool->thread_count = 0;
+  free(pool->deques);
+  pool->deques = NULL;
+  pthread_cond_destroy(&pool->wake);
+  pthread_mutex_destroy(&pool->mutex);
+}
+
+size_t pool_worker_count(const Pool *pool) { return pool->thread_count + 1; }
+
+static Pool_Loop *acquire_loop(Pool *pool, size_t *slot) {
+  for (;;) {
+    for (size_t i = 0; i < POOL_MAX_LOOPS; i++) {
+      bool used = false;
+      if (atomic_compare_exchange_strong(&pool->loops[i].used, &used, true)) {
+        *slot = i;
+        return &pool->loops[i];
+      }
+    }
+    sched_yield();
+  }
+}
+
+// Items first..first + count of one loop, count at most JOB_MAX_ITEMS
+static void run_loop(Pool *pool, size_t worker, Pool_Task task, void *context,
+                     size_t first, size_t count) {
+  size_t slot;
+  Pool_Loop *loop = acquire_loop(pool, &slot);
+  loop->task = task;
+  loop->context = context;
+  loop->first = first;
+  atomic_store(&loop->pending, count);
+
+  run_job(pool, worker, job_make(slot, 0, count));
+  // Help out until the loop's last items are done, with this loop's jobs
+  // or anybody else's
+  uint64_t rng = 0x9E3779B97F4A7C15ull * (worker + 1) ^ (uint64_t)first;
+  while (atomic_load(&loop->pending) > 0) {
+    uint64_t job;
+    if (find_job(pool, worker, &rng, &job)) {
+      run_job(pool, worker, job);
+    } else {
+      sched_yield();
+    }
+  }
+  atomic_store(&loop->used, false);
+}
+
+void pool_run(Pool *pool, Pool_Task task, void *context, size_t count) {
+  if (pool->thread_count == 0 || count <= 1) {
+    size_t worker = current_pool == pool ? current_worker : 0;
+    for (size_t i = 0; i < count; i++) {
+      task(context, i, worker);
+    }
+    return;
+  }
+
+  bool outside = current_pool != pool;
+  if (outside) {
+    current_pool = pool;
+    current_worker = 0;
+  }
+  for (size_t first = 0; first < count; first += JOB_MAX_ITEMS) {
+    size_t rest = count - first;
+    run_loop(pool, current_worker, task, context, first,
+             rest < JOB_MAX_ITEMS ? rest : JOB_MAX_ITEMS);
+  }
+  if (outside) {
+    current_pool = NULL;
+  }
+}
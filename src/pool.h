@@ -0,0 +1,98 @@
+#ifndef POOL_H_
+#define POOL_H_
+
+// A work stealing scheduler for parallel loops. Every worker owns a deque
+// of jobs, a job being a range of one loop's items. A worker that takes a
+// range pushes its upper half back and keeps halving until one item is
+// left, so idle workers steal big ranges off the top of somebody's deque
+// while the owner works through small ones at the bottom, without a lock
+// (Chase and Lev's deque). A loop of a million items costs each worker a
+// handful of steals, not a million trips through a shared queue.
+//
+// Loops nest: a task may run a loop of its own, and a thread waiting for
+// its loop to finish runs whatever jobs it can find meanwhile. Per worker
+// scratch therefore mustn't be held across a nested pool_run.
+//
+// The calling thread works too, so a pool with n threads keeps n + 1 cores
+// busy. Where threads can't be started, e.g. a web build without thread
+// support, every loop runs on the caller alone.
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define POOL_MAX_THREADS 255
+// Loops running at once, nested ones included
+#define POOL_MAX_LOOPS 256
+// Jobs a deque holds, halving keeps it to about log2(items) per loop
+#define POOL_DEQUE_SIZE 1024
+#define POOL_CACHE_LINE 64
+
+// Runs one item of a loop. worker is 0 on the thread that called pool_run
+// from outside the pool and 1..threads on the pool's own, so per worker
+// scratch can be indexed without locking.
+typedef void (*Pool_Task)(void *context, size_t index, size_t worker);
+
+typedef struct {
+  Pool_Task task;
+  void *context;
+  // Index of the loop's item 0, huge loops run in pieces
+  size_t first;
+  // Items not done yet
+  atomic_size_t pending;
+  atomic_bool used;
+} Pool_Loop;
+
+typedef struct {
+  // Thieves take from the top, the owner pushes and pops at the bottom.
+  // Kept on separate cache lines, both are hammered by different threads.
+  atomic_int_fast64_t top;
+  char top_padding[POOL_CACHE_LINE - sizeof(atomic_int_fast64_t)];
+  atomic_int_fast64_t bottom;
+  char bottom_padding[POOL_CACHE_LINE - sizeof(atomic_int_fast64_t)];
+  _Atomic uint64_t jobs[POOL_DEQUE_SIZE];
+} Pool_Deque;
+
+typedef struct Pool Pool;
+
+typedef struct {
+  Pool *pool;
+  size_t index;
+} Pool_Worker;
+
+// Workers keep a pointer to the pool, don't move it after pool_init.
+struct Pool {
+  pthread_t threads[POOL_MAX_THREADS];
+  Pool_Worker workers[POOL_MAX_THREADS];
+  size_t thread_count;
+  // One per worker, index 0 belongs to the outside caller
+  Pool_Deque *deques;
+  Pool_Loop loops[POOL_MAX_LOOPS];
+
+  // Idle workers sleep here until a job is pushed
+  pthread_mutex_t mutex;
+  pthread_cond_t wake;
+  atomic_size_t sleeping;
+  atomic_bool stop;
+
+  atomic_uint_fast64_t steals;
+};
+
+// Monotonic wall clock in seconds, for the time budgets of parallel searches
+double pool_seconds(void);
+// One less than the online processors, the caller is the last worker
+size_t pool_default_threads(void);
+// Starts up to threads workers. Fewer start if the system refuses, which
+// only costs speed.
+void pool_init(Pool *pool, size_t threads);
+void pool_free(Pool *pool);
+// Threads that run items, the caller included
+size_t pool_worker_count(const Pool *pool);
+// Calls task for every index below count, spread over the workers, and
+// returns when all of them are done. Only one thread from outside the pool
+// may run loops at a time, tasks may run their own.
+void pool_run(Pool *pool, Pool_Task task, void *context, size_t count);
+
+#endif // POOL_H_
@@ -0,0 +1,250 @@
+#include "search.h"
+#include <stdlib.h>
+#include <string.h>
+
+bool search_init(Search *search, Pool *pool, Tt *tt,
+                 const Bot_Weights *weights, size_t beam_width,
+                 double time_budget) {
+  memset(search, 0, sizeof(*search));
+  search->pool = pool;
+  search->tt = tt;
+  if (beam_width == 0)
+    beam_width = 1;
+  search->weights = *weights;
+  search->beam_width = beam_width;
+  search->time_budget = time_budget;
+  search->node_slots =
+      beam_width < MAX_PLACEMENTS ? beam_width : MAX_PLACEMENTS;
+  search->seen_capacity = 16;
+  while (search->seen_capacity < beam_width * 2)
+    search->seen_capacity *= 2;
+  atomic_init(&search->out_of_time, false);
+  atomic_init(&search->evaluated, 0);
+
+  size_t workers = pool_worker_count(pool);
+  search->bots = malloc(workers * sizeof(Bot));
+  search->scratch =
+      malloc(workers * MAX_PLACEMENTS * sizeof(Search_Candidate));
+  search->beam = malloc(beam_width * sizeof(Search_Node));
+  search->next_beam = malloc(beam_width * sizeof(Search_Node));
+  search->candidates =
+      malloc(beam_width * search->node_slots * sizeof(Search_Candidate));
+  search->candidate_counts = malloc(beam_width * sizeof(size_t));
+  search->seen = malloc(search->seen_capacity * sizeof(uint64_t));
+  if (search->bots == NULL || search->scratch == NULL ||
+      search->beam == NULL || search->next_beam == NULL ||
+      search->candidates == NULL || search->candidate_counts == NULL ||
+      search->seen == NULL) {
+    search_free(search);
+    return false;
+  }
+  for (size_t i = 0; i < workers; i++) {
+    bot_init(&search->bots[i], weights);
+  }
+  return true;
+}
+
+void search_free(Search *search) {
+  free(search->bots);
+  free(search->scratch);
+  free(search->beam);
+  free(search->next_beam);
+  free(search->candidates);
+  free(search->candidate_counts);
+  free(search->seen);
+  search->bots = NULL;
+  search->scratch = NULL;
+  search->beam = NULL;
+  search->next_beam = NULL;
+  search->candidates = NULL;
+  search->candidate_counts = NULL;
+  search->seen = NULL;
+}
+
+// Best first
+static int compare_candidates(const void *a, const void *b) {
+  float sa = ((const Search_Candidate *)a)->score;
+  float sb = ((const Search_Candidate *)b)->score;
+  return (sa < sb) - (sa > sb);
+}
+
+// Scores every placement of the level's piece on one board of the beam
+static void expand_node(void *context, size_t index, size_t worker) {
+  Search *search = context;
+  search->candidate_counts[index] = 0;
+  if (search->depth > 0 && pool_seconds() > search->deadline) {
+    atomic_store(&search->out_of_time, true);
+    return;
+  }
+
+  const Search_Node *node = &search->beam[index];
+  Search_Candidate *scratch = search->scratch + worker * MAX_PLACEMENTS;
+  uint64_t key = 0;
+  if (search->last_level && search->tt != NULL) {
+    key = tt_key(node->hash, search->piece);
+    Tt_Move move;
+    if (tt_probe(search->tt, key, worker, &move)) {
+      // The lines only go into the reward, which isn't needed any more
+      scratch[0] = (Search_Candidate){
+          .score = node->reward + move.score,
+          .parent = (uint32_t)index,
+          .placement = move.placement,
+      };
+      search->candidate_counts[index] = move.found;
+      memcpy(search->candidates + index * search->node_slots, scratch,
+             sizeof(Search_Candidate));
+      return;
+    }
+  }
+
+  Bot *bot = &search->bots[worker];
+  size_t n = bot_evaluate(bot, node->board, search->piece);
+  atomic_fetch_add(&search->evaluated, n);
+
+  size_t count = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (bot->topped_out[i])
+      continue;
+    scratch[count++] = (Search_Candidate){
+        .score = node->reward + bot->scores[i],
+        .lines = bot->lines[i],
+        .parent = (uint32_t)index,
+        .placement = bot->placements[i],
+    };
+  }
+  if (search->last_level) {
+    size_t best = 0;
+    for (size_t i = 1; i < count; i++) {
+      if (scratch[i].score > scratch[best].score)
+        best = i;
+    }
+    scratch[0] = scratch[best];
+    if (search->tt != NULL) {
+      Tt_Move move = {
+          .found = count > 0,
+          .placement = scratch[0].placement,
+          .score = scratch[0].score - node->reward,
+      };
+      tt_store(search->tt, key, worker, &move);
+    }
+    count = count > 0;
+  } else if (count > search->node_slots) {
+    qsort(scratch, count, sizeof(Search_Candidate), compare_candidates);
+    count = search->node_slots;
+  }
+  memcpy(search->candidates + index * search->node_slots, scratch,
+         count * sizeof(Search_Candidate));
+  search->candidate_counts[index] = count;
+}
+
+// False if a board with this hash already made the next beam
+static bool seen_insert(Search *search, uint64_t hash) {
+  // 0 marks an empty slot
+  hash |= hash == 0;
+  size_t mask = search->seen_capacity - 1;
+  for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+    if (search->seen[slot] == hash)
+      return false;
+    if (search->seen[slot] == 0) {
+      search->seen[slot] = hash;
+      return true;
+    }
+  }
+}
+
+// Locks the best candidates into boards until the next beam is full,
+// skipping boards reached another way already
+static size_t select_beam(Search *search) {
+  size_t total = 0;
+  for (size_t i = 0; i < search->beam_count; i++) {
+    memmove(search->candidates + total,
+            search->candidates + i * search->node_slots,
+            search->candidate_counts[i] * sizeof(Search_Candidate));
+    total += search->candidate_counts[i];
+  }
+  qsort(search->candidates, total, sizeof(Search_Candidate),
+        compare_candidates);
+
+  memset(search->seen, 0, search->seen_capacity * sizeof(uint64_t));
+  size_t count = 0;
+  for (size_t i = 0; i < total && count < search->beam_width; i++) {
+    const Search_Candidate *c = &search->candidates[i];
+    const Search_Node *parent = &search->beam[c->parent];
+    Search_Node *child = &search->next_beam[count];
+    memcpy(child->board, parent->board, sizeof(child->board));
+    uint64_t hash =
+        parent->hash ^ board_add_tetromino(child->board, c->placement);
+    Column full = board_full_rows(child->board);
+    if (full) {
+      board_clear_rows(child->board, full);
+      hash = zobrist_board(child->board);
+    }
+    if (!seen_insert(search, hash))
+      continue;
+    child->hash = hash;
+    child->score = c->score;
+    child->reward = parent->reward + search->weights.lines * c->lines;
+    child->first = search->depth == 0 ? c->placement : parent->first;
+    count++;
+  }
+  return count;
+}
+
+bool search_choose(Search *search, const Row *board, Tetromino tetromino,
+                   const Tetromino *preview, size_t preview_count,
+                   Tetromino *best) {
+  double start = pool_seconds();
+  search->deadline = start + search->time_budget;
+  search->depth = 0;
+  atomic_store(&search->out_of_time, false);
+  atomic_store(&search->evaluated, 0);
+  if (search->tt != NULL)
+    tt_new_search(search->tt);
+
+  Search_Node *root = &search->beam[0];
+  memcpy(root->board, board, sizeof(root->board));
+  root->hash = zobrist_board(root->board);
+  root->score = 0;
+  root->reward = 0;
+  root->first = tetromino;
+  search->beam_count = 1;
+
+  for (size_t level = 0; level <= preview_count; level++) {
+    if (level == 0) {
+      search->piece = tetromino;
+    } else {
+      search->piece = preview[level - 1];
+      search->piece.pos.x = tet_spawn_x[search->piece.type];
+      search->piece.pos.y = 0;
+      search->piece.state = 0;
+    }
+    search->last_level = level == preview_count;
+    pool_run(search->pool, expand_node, search, search->beam_count);
+    if (atomic_load(&search->out_of_time))
+      break;
+    size_t count = select_beam(search);
+    // Every way on tops out, the previous level decides
+    if (count == 0)
+      break;
+
+    Search_Node *t = search->beam;
+    search->beam = search->next_beam;
+    search->next_beam = t;
+    search->beam_count = count;
+    search->depth++;
+  }
+
+  search->nodes = atomic_load(&search->evaluated);
+  search->seconds = pool_seconds() - start;
+  if (search->depth == 0)
+    return false;
+  // select_beam fills the beam best first
+  *best = search->beam[0].first;
+  return true;
+}
+
+bool search_choose_game(Search *search, const Game_State *g, Tetromino *best) {
+  return search_choose(search, g->board, g->tetromino,
+                       g->tetromino_bag + g->tetromino_bag_used,
+                       7 - g->tetromino_bag_used, best);
+}
@@ -0,0 +1,100 @@
+#ifndef SEARCH_H_
+#define SEARCH_H_
+
+// Beam search through the pieces known in advance: the falling tetromino
+// and whatever is left of its 7-bag. Every level places the next piece on
+// each board of the beam, scores the results with the bot's evaluation plus
+// the lines cleared on the way, and keeps the best beam_width distinct
+// boards. The boards of a level are expanded in parallel on a thread pool,
+// one Bot scratch per worker. The pool can be shared with other searches.
+//
+// A level that doesn't finish within the time budget is thrown away and the
+// best board of the previous one decides, the first level always runs.
+//
+// On the last level only each board's best placement matters, which is the
+// greedy bot's choice. With a transposition table those come from the
+// table when this or an earlier search already worked them out.
+
+#include "bot.h"
+#include "game.h"
+#include "pool.h"
+#include "tt.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SEARCH_DEFAULT_BEAM_WIDTH 64
+#define SEARCH_DEFAULT_TIME_BUDGET 0.005
+
+typedef struct {
+  Row board[BOARD_ROWS + 3];
+  uint64_t hash;
+  // The board's evaluation plus the lines cleared on the way there
+  float score;
+  // Just the lines, weighted
+  float reward;
+  // Placement of the searched piece this board descends from
+  Tetromino first;
+} Search_Node;
+
+typedef struct {
+  float score;
+  int32_t lines;
+  uint32_t parent;
+  Tetromino placement;
+} Search_Candidate;
+
+typedef struct {
+  Pool *pool;
+  // NULL for none
+  Tt *tt;
+  Bot_Weights weights;
+  size_t beam_width;
+  // Seconds, measured from the start of search_choose
+  double time_budget;
+
+  // One of each per pool worker
+  Bot *bots;
+  Search_Candidate *scratch;
+
+  Search_Node *beam;
+  Search_Node *next_beam;
+  size_t beam_count;
+  // A node keeps its best node_slots children, only that many can make the
+  // next beam anyway
+  size_t node_slots;
+  Search_Candidate *candidates;
+  size_t *candidate_counts;
+  uint64_t *seen;
+  size_t seen_capacity;
+
+  // The level being expanded
+  Tetromino piece;
+  bool last_level;
+  double deadline;
+  atomic_bool out_of_time;
+  atomic_uint_fast64_t evaluated;
+
+  // Statistics of the last search
+  size_t depth;
+  uint64_t nodes;
+  double seconds;
+} Search;
+
+// Expands on pool and shares tt, if not NULL, with whoever else uses it.
+// Both must outlive the search. False when out of memory.
+bool search_init(Search *search, Pool *pool, Tt *tt,
+                 const Bot_Weights *weights, size_t beam_width,
+                 double time_budget);
+void search_free(Search *search);
+// The placement of tetromino with the best board after the preview pieces,
+// false when tetromino has nowhere to go. Preview pieces are placed from
+// their spawn position.
+bool search_choose(Search *search, const Row *board, Tetromino tetromino,
+                   const Tetromino *preview, size_t preview_count,
+                   Tetromino *best);
+// Searches through the rest of the game's bag
+bool search_choose_game(Search *search, const Game_State *g, Tetromino *best);
+
+#endif // SEARCH_H_
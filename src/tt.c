@@ -0,0 +1,164 @@
+#include "tt.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Layout of an entry's data word
+#define DATA_SCORE_SHIFT 0
+#define DATA_TYPE_SHIFT 32
+#define DATA_STATE_SHIFT 35
+#define DATA_X_SHIFT 37
+#define DATA_Y_SHIFT 45
+#define DATA_FOUND_BIT ((uint64_t)1 << 53)
+// Set in every stored entry, so a used entry's data is never 0
+#define DATA_USED_BIT ((uint64_t)1 << 54)
+#define DATA_GENERATION_SHIFT 56
+
+bool tt_init(Tt *tt, size_t bytes) {
+  size_t count = 1;
+  while (count * 2 * sizeof(Tt_Bucket) <= bytes)
+    count *= 2;
+  tt->bucket_count = count;
+  tt->buckets = malloc(count * sizeof(Tt_Bucket));
+  if (tt->buckets == NULL)
+    return false;
+  atomic_init(&tt->generation, 0);
+  tt_clear(tt);
+  tt_reset_stats(tt);
+  return true;
+}
+
+void tt_free(Tt *tt) {
+  free(tt->buckets);
+  tt->buckets = NULL;
+  tt->bucket_count = 0;
+}
+
+void tt_clear(Tt *tt) {
+  memset(tt->buckets, 0, tt->bucket_count * sizeof(Tt_Bucket));
+}
+
+void tt_new_search(Tt *tt) { atomic_fetch_add(&tt->generation, 1); }
+
+uint64_t tt_key(uint64_t board_hash, Tetromino tetromino) {
+  return board_hash ^ zobrist_tetromino(tetromino);
+}
+
+static uint64_t pack(const Tt_Move *move, unsigned generation) {
+  uint32_t score;
+  memcpy(&score, &move->score, sizeof(score));
+  return (uint64_t)score << DATA_SCORE_SHIFT |
+         (uint64_t)move->placement.type << DATA_TYPE_SHIFT |
+         (uint64_t)move->placement.state << DATA_STATE_SHIFT |
+         (uint64_t)(uint8_t)move->placement.pos.x << DATA_X_SHIFT |
+         (uint64_t)(uint8_t)move->placement.pos.y << DATA_Y_SHIFT |
+         (move->found ? DATA_FOUND_BIT : 0) | DATA_USED_BIT |
+         (uint64_t)(generation & 0xFF) << DATA_GENERATION_SHIFT;
+}
+
+static void unpack(uint64_t data, Tt_Move *move) {
+  uint32_t score = (uint32_t)(data >> DATA_SCORE_SHIFT);
+  memcpy(&move->score, &score, sizeof(score));
+  move->placement.type = (data >> DATA_TYPE_SHIFT) & 0x7;
+  move->placement.state = (data >> DATA_STATE_SHIFT) & 0x3;
+  move->placement.pos.x = (int8_t)(uint8_t)(data >> DATA_X_SHIFT);
+  move->placement.pos.y = (int8_t)(uint8_t)(data >> DATA_Y_SHIFT);
+  move->found = (data & DATA_FOUND_BIT) != 0;
+}
+
+// Searches since the entry was last stored or hit, modulo 256
+static unsigned entry_age(uint64_t data, unsigned generation) {
+  return (generation - (unsigned)(data >> DATA_GENERATION_SHIFT)) & 0xFF;
+}
+
+static void count(_Atomic uint64_t *counter) {
+  // Only its own worker writes a counter, no need for a locked add
+  atomic_store_explicit(
+      counter, atomic_load_explicit(counter, memory_order_relaxed) + 1,
+      memory_order_relaxed);
+}
+
+static Tt_Bucket *bucket_of(Tt *tt, uint64_t key) {
+  return &tt->buckets[key & (tt->bucket_count - 1)];
+}
+
+bool tt_probe(Tt *tt, uint64_t key, size_t worker, Tt_Move *move) {
+  Tt_Counters *counters = &tt->counters[worker];
+  count(&counters->probes);
+  Tt_Bucket *bucket = bucket_of(tt, key);
+  unsigned generation = atomic_load_explicit(&tt->generation,
+                                             memory_order_relaxed);
+  for (size_t i = 0; i < TT_BUCKET_ENTRIES; i++) {
+    Tt_Entry *entry = &bucket->entries[i];
+    uint64_t data = atomic_load_explicit(&entry->data, memory_order_relaxed);
+    uint64_t check = atomic_load_explicit(&entry->check, memory_order_relaxed);
+    if (!(data & DATA_USED_BIT) || (check ^ data) != key)
+      continue;
+    unpack(data, move);
+    count(&counters->hits);
+    // Still useful, keep it from being replaced like an old one. Written
+    // back where it is, which isn't a store for the counters.
+    if (entry_age(data, generation) != 0) {
+      data = (data & ~((uint64_t)0xFF << DATA_GENERATION_SHIFT)) |
+             (uint64_t)(generation & 0xFF) << DATA_GENERATION_SHIFT;
+      atomic_store_explicit(&entry->data, data, memory_order_relaxed);
+      atomic_store_explicit(&entry->check, key ^ data, memory_order_relaxed);
+    }
+    return true;
+  }
+  return false;
+}
+
+void tt_store(Tt *tt, uint64_t key, size_t worker, const Tt_Move *move) {
+  count(&tt->counters[worker].stores);
+  Tt_Bucket *bucket = bucket_of(tt, key);
+  unsigned generation = atomic_load_explicit(&tt->generation,
+                                             memory_order_relaxed);
+  // The same key, else the first empty entry, else the oldest
+  Tt_Entry *victim = NULL;
+  unsigned victim_age = 0;
+  for (size_t i = 0; i < TT_BUCKET_ENTRIES; i++) {
+    Tt_Entry *entry = &bucket->entries[i];
+    uint64_t data = atomic_load_explicit(&entry->data, memory_order_relaxed);
+    uint64_t check = atomic_load_explicit(&entry->check, memory_order_relaxed);
+    if (!(data & DATA_USED_BIT)) {
+      if (victim == NULL || victim_age < 256) {
+        victim = entry;
+        // Beats any age, but not the same key further on
+        victim_age = 256;
+      }
+      continue;
+    }
+    if ((check ^ data) == key) {
+      victim = entry;
+      break;
+    }
+    unsigned age = entry_age(data, generation);
+    if (victim == NULL || age > victim_age) {
+      victim = entry;
+      victim_age = age;
+    }
+  }
+
+  uint64_t data = pack(move, generation);
+  atomic_store_explicit(&victim->data, data, memory_order_relaxed);
+  atomic_store_explicit(&victim->check, key ^ data, memory_order_relaxed);
+}
+
+Tt_Stats tt_stats(const Tt *tt) {
+  Tt_Stats stats = {0};
+  for (size_t i = 0; i <= POOL_MAX_THREADS; i++) {
+    stats.probes += atomic_load(&tt->counters[i].probes);
+    stats.hits += atomic_load(&tt->counters[i].hits);
+    stats.stores += atomic_load(&tt->counters[i].stores);
+  }
+  stats.misses = stats.probes - stats.hits;
+  return stats;
+}
+
+void tt_reset_stats(Tt *tt) {
+  for (size_t i = 0; i <= POOL_MAX_THREADS; i++) {
+    atomic_store(&tt->counters[i].probes, 0);
+    atomic_store(&tt->counters[i].hits, 0);
+    atomic_store(&tt->counters[i].stores, 0);
+  }
+}
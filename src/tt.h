@@ -0,0 +1,82 @@
+#ifndef TT_H_
+#define TT_H_
+
+// Transposition table of the bot's greedy decisions: for a board and a
+// piece, the best scoring placement and its score. The searches hit the
+// same board and piece again and again, in rollouts, across iterations and
+// from one move's search to the next, and skip the bot's evaluation when
+// the table knows the answer. One table serves one set of weights.
+//
+// The table has a fixed size and is shared by every thread without a lock.
+// An entry is two words, the data and the key xor the data, so a read torn
+// by a concurrent write fails the key check and counts as a miss. Entries
+// sit in buckets of four on one cache line. A store takes the entry with
+// the same key, else an empty one, else the one left longest by its search:
+// tt_new_search ages the whole table at once by bumping a generation.
+
+#include "game.h"
+#include "pool.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TT_BUCKET_ENTRIES 4
+#define TT_DEFAULT_BYTES ((size_t)64 << 20)
+
+typedef struct {
+  _Atomic uint64_t check;
+  _Atomic uint64_t data;
+} Tt_Entry;
+
+typedef struct {
+  Tt_Entry entries[TT_BUCKET_ENTRIES];
+} Tt_Bucket;
+
+// Per worker, so counting doesn't bounce a cache line between threads. Each
+// counter has a single writer only while one pool owns the table: workers
+// of two pools share indices and lose counts, and the stats are then only
+// a rough guide.
+typedef struct {
+  _Atomic uint64_t probes;
+  _Atomic uint64_t hits;
+  _Atomic uint64_t stores;
+  char padding[POOL_CACHE_LINE - 3 * sizeof(uint64_t)];
+} Tt_Counters;
+
+typedef struct {
+  // False when every placement tops out
+  bool found;
+  Tetromino placement;
+  float score;
+} Tt_Move;
+
+typedef struct {
+  uint64_t probes;
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t stores;
+} Tt_Stats;
+
+typedef struct {
+  Tt_Bucket *buckets;
+  size_t bucket_count;
+  atomic_uint generation;
+  Tt_Counters counters[POOL_MAX_THREADS + 1];
+} Tt;
+
+// Takes the largest power of two of buckets that fits in bytes. False when
+// out of memory.
+bool tt_init(Tt *tt, size_t bytes);
+void tt_free(Tt *tt);
+void tt_clear(Tt *tt);
+// Call when a search starts, entries of older searches get replaced first
+void tt_new_search(Tt *tt);
+uint64_t tt_key(uint64_t board_hash, Tetromino tetromino);
+// worker is the pool worker calling, for the counters
+bool tt_probe(Tt *tt, uint64_t key, size_t worker, Tt_Move *move);
+void tt_store(Tt *tt, uint64_t key, size_t worker, const Tt_Move *move);
+Tt_Stats tt_stats(const Tt *tt);
+void tt_reset_stats(Tt *tt);
+
+#endif // TT_H_
@@ -0,0 +1,498 @@
+// tune: tunes the bot's evaluation weights with CMA-ES on self-play.
+//
+//   ./build/tune [state] [generations] [games] [pieces] [threads]
+//
+// Every generation samples weight vectors around the current mean and
+// scores each, and the mean itself, by the lines the greedy bot clears in
+// games seeded games of up to pieces pieces. Plain games would hardly tell
+// them apart, as good weights about never top out, so a garbage row with a
+// random hole rises every GARBAGE_INTERVAL pieces and games end when the
+// bot can't keep up, usually long before pieces. All vectors of a generation
+// play the same seeds, so luck of the bag doesn't decide between them, and
+// the next generation plays new ones. The games run on threads extra
+// workers, by default every core.
+//
+// After every generation the whole search state is written to state
+// (tune.state by default) and a line of progress appended to state.log.
+// Started again with an existing state it carries on where it stopped,
+// so it can be interrupted at any time and only loses the generation in
+// flight. generations is how many to run, 0 (the default) until stopped.
+// The best weights so far are kept in the state and printed ready to paste
+// into bot.c whenever they improve.
+
+#include "args.h"
+#include "bot.h"
+#include "game.h"
+#include "pool.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define N (sizeof(Bot_Weights) / sizeof(float))
+// Offspring per generation, 4 + 3 ln N
+#define LAMBDA 9
+#define MU (LAMBDA / 2)
+#define INITIAL_SIGMA 1.0
+#define STATE_VERSION 2
+// A garbage row comes up before every this many pieces
+#define GARBAGE_INTERVAL 6
+
+static const char *weight_names[N] = {
+    "aggregate_height",   "holes", "bumpiness", "row_transitions",
+    "column_transitions", "wells", "lines",
+};
+
+typedef struct {
+  uint64_t generation;
+  // Mixed into every game's seed
+  uint64_t seed;
+  Rng rng;
+
+  double mean[N];
+  double sigma;
+  double covariance[N][N];
+  double path_sigma[N];
+  double path_c[N];
+
+  double best_fitness;
+  double best[N];
+} Tuner;
+
+// The games of one generation
+typedef struct {
+  // One per pool worker
+  Bot *bots;
+  // The offspring, then the mean
+  Bot_Weights weights[LAMBDA + 1];
+  uint64_t generation;
+  uint64_t seed;
+  size_t games;
+  uint64_t max_pieces;
+  // [candidate * games + game]
+  uint32_t *lines;
+  uint32_t *pieces;
+} Generation;
+
+static Pool pool;
+
+static void to_weights(const double *x, Bot_Weights *weights) {
+  float f[N];
+  for (size_t i = 0; i < N; i++) {
+    f[i] = (float)x[i];
+  }
+  memcpy(weights, f, sizeof(*weights));
+}
+
+static void print_weights(FILE *f, const double *x) {
+  fprintf(f, "const Bot_Weights bot_default_weights = {\n");
+  for (size_t i = 0; i < N; i++) {
+    fprintf(f, "    .%s = %.4ff,\n", weight_names[i], x[i]);
+  }
+  fprintf(f, "};\n");
+}
+
+static void play_game(void *context, size_t index, size_t worker) {
+  Generation *job = context;
+  size_t candidate = index / job->games;
+  size_t game = index % job->games;
+  Bot *bot = &job->bots[worker];
+  bot_init(bot, &job->weights[candidate]);
+
+  uint64_t seed = job->seed ^ (job->generation << 32 | game);
+  Game_State g;
+  game_init(&g, seed);
+  // Its own stream, the bag stays the one game_init seeded
+  Rng holes;
+  rng_seed(&holes, ~seed);
+  uint32_t pieces = 0, lines = 0;
+  while (pieces < job->max_pieces) {
+    if (pieces % GARBAGE_INTERVAL == GARBAGE_INTERVAL - 1 &&
+        !game_add_garbage(&g, rng_below(&holes, BOARD_WIDTH)))
+      break;
+    Tetromino best;
+    if (!bot_choose(bot, g.board, g.tetromino, &best))
+      break;
+    int cleared = game_place(&g, best);
+    if (cleared < 0)
+      break;
+    lines += cleared;
+    pieces++;
+  }
+  job->lines[index] = lines;
+  job->pieces[index] = pieces;
+}
+
+// Standard normal, Box-Muller
+static double gaussian(Rng *rng) {
+  double u1 = ((rng_next(rng) >> 11) + 1) * 0x1.0p-53;
+  double u2 = (rng_next(rng) >> 11) * 0x1.0p-53;
+  return sqrt(-2.0 * log(u1)) * cos(6.283185307179586 * u2);
+}
+
+// Cyclic Jacobi: a = vectors * diag(values) * vectors^T for symmetric a
+static void eigen(const double a[N][N], double values[N],
+                  double vectors[N][N]) {
+  double m[N][N];
+  memcpy(m, a, sizeof(m));
+  for (size_t i = 0; i < N; i++) {
+    for (size_t j = 0; j < N; j++) {
+      vectors[i][j] = i == j;
+    }
+  }
+  for (int sweep = 0; sweep < 64; sweep++) {
+    double off = 0;
+    for (size_t p = 0; p < N; p++) {
+      for (size_t q = p + 1; q < N; q++) {
+        off += m[p][q] * m[p][q];
+      }
+    }
+    if (off < 1e-30)
+      break;
+    for (size_t p = 0; p < N; p++) {
+      for (size_t q = p + 1; q < N; q++) {
+        if (m[p][q] == 0)
+          continue;
+        double theta = (m[q][q] - m[p][p]) / (2 * m[p][q]);
+        double t = (theta >= 0 ? 1 : -1) /
+                   (fabs(theta) + sqrt(theta * theta + 1));
+        double c = 1 / sqrt(t * t + 1), s = t * c;
+        for (size_t k = 0; k < N; k++) {
+          double kp = m[k][p], kq = m[k][q];
+          m[k][p] = c * kp - s * kq;
+          m[k][q] = s * kp + c * kq;
+        }
+        for (size_t k = 0; k < N; k++) {
+          double pk = m[p][k], qk = m[q][k];
+          m[p][k] = c * pk - s * qk;
+          m[q][k] = s * pk + c * qk;
+        }
+        for (size_t k = 0; k < N; k++) {
+          double kp = vectors[k][p], kq = vectors[k][q];
+          vectors[k][p] = c * kp - s * kq;
+          vectors[k][q] = s * kp + c * kq;
+        }
+      }
+    }
+  }
+  for (size_t i = 0; i < N; i++) {
+    values[i] = m[i][i];
+  }
+}
+
+static void tuner_init(Tuner *t, uint64_t seed) {
+  memset(t, 0, sizeof(*t));
+  t->seed = seed;
+  rng_seed(&t->rng, seed);
+  float f[N];
+  memcpy(f, &bot_default_weights, sizeof(f));
+  for (size_t i = 0; i < N; i++) {
+    t->mean[i] = f[i];
+    t->best[i] = f[i];
+    t->covariance[i][i] = 1;
+  }
+  t->sigma = INITIAL_SIGMA;
+  t->best_fitness = -1;
+}
+
+static void write_doubles(FILE *f, const char *name, const double *x,
+                          size_t count) {
+  fprintf(f, "%s", name);
+  for (size_t i = 0; i < count; i++) {
+    fprintf(f, " %.17g", x[i]);
+  }
+  fprintf(f, "\n");
+}
+
+static bool read_doubles(FILE *f, const char *name, double *x,
+                         size_t count) {
+  char label[32];
+  if (fscanf(f, "%31s", label) != 1 || strcmp(label, name) != 0)
+    return false;
+  for (size_t i = 0; i < count; i++) {
+    if (fscanf(f, "%lf", &x[i]) != 1)
+      return false;
+  }
+  return true;
+}
+
+// Written next to path and renamed over it, so an interruption leaves
+// either the old state or the new one
+static bool tuner_save(const Tuner *t, const char *path) {
+  char temp[4096];
+  snprintf(temp, sizeof(temp), "%s.tmp", path);
+  FILE *f = fopen(temp, "w");
+  if (f == NULL)
+    return false;
+  fprintf(f, "version %d\n", STATE_VERSION);
+  fprintf(f, "generation %llu\n", (unsigned long long)t->generation);
+  fprintf(f, "seed %llu\n", (unsigned long long)t->seed);
+  fprintf(f, "rng %llu %llu %llu %llu\n", (unsigned long long)t->rng.s[0],
+          (unsigned long long)t->rng.s[1], (unsigned long long)t->rng.s[2],
+          (unsigned long long)t->rng.s[3]);
+  write_doubles(f, "mean", t->mean, N);
+  write_doubles(f, "sigma", &t->sigma, 1);
+  write_doubles(f, "covariance", &t->covariance[0][0], N * N);
+  write_doubles(f, "path_sigma", t->path_sigma, N);
+  write_doubles(f, "path_c", t->path_c, N);
+  write_doubles(f, "best_fitness", &t->best_fitness, 1);
+  write_doubles(f, "best", t->best, N);
+  bool ok = fclose(f) == 0;
+  return ok && rename(temp, path) == 0;
+}
+
+static bool tuner_load(Tuner *t, FILE *f) {
+  int version;
+  unsigned long long generation, seed, s[4];
+  bool ok =
+      fscanf(f, " version %d", &version) == 1 && version == STATE_VERSION &&
+      fscanf(f, " generation %llu", &generation) == 1 &&
+      fscanf(f, " seed %llu", &seed) == 1 &&
+      fscanf(f, " rng %llu %llu %llu %llu", &s[0], &s[1], &s[2], &s[3]) ==
+          4 &&
+      read_doubles(f, "mean", t->mean, N) &&
+      read_doubles(f, "sigma", &t->sigma, 1) &&
+      read_doubles(f, "covariance", &t->covariance[0][0], N * N) &&
+      read_doubles(f, "path_sigma", t->path_sigma, N) &&
+      read_doubles(f, "path_c", t->path_c, N) &&
+      read_doubles(f, "best_fitness", &t->best_fitness, 1) &&
+      read_doubles(f, "best", t->best, N);
+  if (!ok)
+    return false;
+  t->generation = generation;
+  t->seed = seed;
+  for (size_t i = 0; i < 4; i++) {
+    t->rng.s[i] = s[i];
+  }
+  return true;
+}
+
+typedef struct {
+  double fitness;
+  size_t index;
+} Ranked;
+
+static int compare_ranked(const void *a, const void *b) {
+  double fa = ((const Ranked *)a)->fitness, fb = ((const Ranked *)b)->fitness;
+  return (fa < fb) - (fa > fb);
+}
+
+// One generation: sample, play, rank, move the distribution
+static void tuner_step(Tuner *t, Generation *job, double *mean_fitness,
+                       double *best_fitness, double *worst_fitness,
+                       uint64_t *pieces) {
+  // Recombination weights and the learning rates, Hansen's defaults
+  double w[MU], w_sum = 0, w_sq = 0;
+  for (size_t i = 0; i < MU; i++) {
+    w[i] = log(MU + 0.5) - log(i + 1.0);
+    w_sum += w[i];
+  }
+  for (size_t i = 0; i < MU; i++) {
+    w[i] /= w_sum;
+    w_sq += w[i] * w[i];
+  }
+  double mueff = 1 / w_sq;
+  double n = N;
+  double cc = (4 + mueff / n) / (n + 4 + 2 * mueff / n);
+  double cs = (mueff + 2) / (n + mueff + 5);
+  double c1 = 2 / ((n + 1.3) * (n + 1.3) + mueff);
+  double cmu = 2 * (mueff - 2 + 1 / mueff) / ((n + 2) * (n + 2) + mueff);
+  if (cmu > 1 - c1)
+    cmu = 1 - c1;
+  double damps = 1 + 2 * fmax(0, sqrt((mueff - 1) / (n + 1)) - 1) + cs;
+  double chi_n = sqrt(n) * (1 - 1 / (4 * n) + 1 / (21 * n * n));
+
+  // covariance = b * diag(d)^2 * b^T
+  double d[N], b[N][N];
+  eigen((const double(*)[N])t->covariance, d, b);
+  for (size_t i = 0; i < N; i++) {
+    d[i] = sqrt(fmax(d[i], 1e-20));
+  }
+
+  double x[LAMBDA][N], y[LAMBDA][N];
+  for (size_t k = 0; k < LAMBDA; k++) {
+    double z[N];
+    for (size_t i = 0; i < N; i++) {
+      z[i] = d[i] * gaussian(&t->rng);
+    }
+    for (size_t i = 0; i < N; i++) {
+      y[k][i] = 0;
+      for (size_t j = 0; j < N; j++) {
+        y[k][i] += b[i][j] * z[j];
+      }
+      x[k][i] = t->mean[i] + t->sigma * y[k][i];
+    }
+    to_weights(x[k], &job->weights[k]);
+  }
+  to_weights(t->mean, &job->weights[LAMBDA]);
+
+  job->generation = t->generation;
+  job->seed = t->seed;
+  pool_run(&pool, play_game, job, (LAMBDA + 1) * job->games);
+
+  Ranked ranked[LAMBDA + 1];
+  *pieces = 0;
+  for (size_t k = 0; k <= LAMBDA; k++) {
+    uint64_t lines = 0;
+    for (size_t i = 0; i < job->games; i++) {
+      lines += job->lines[k * job->games + i];
+      *pieces += job->pieces[k * job->games + i];
+    }
+    ranked[k] = (Ranked){(double)lines / job->games, k};
+  }
+  *mean_fitness = ranked[LAMBDA].fitness;
+  qsort(ranked, LAMBDA + 1, sizeof(Ranked), compare_ranked);
+  *best_fitness = ranked[0].fitness;
+  *worst_fitness = ranked[LAMBDA].fitness;
+  if (ranked[0].fitness > t->best_fitness) {
+    t->best_fitness = ranked[0].fitness;
+    memcpy(t->best, ranked[0].index == LAMBDA ? t->mean : x[ranked[0].index],
+           sizeof(t->best));
+  }
+
+  // The mean ran along for the log and the best, it isn't an offspring
+  double y_w[N] = {0};
+  for (size_t r = 0, k = 0; k < MU; r++) {
+    if (ranked[r].index == LAMBDA)
+      continue;
+    for (size_t i = 0; i < N; i++) {
+      y_w[i] += w[k] * y[ranked[r].index][i];
+    }
+    ranked[k++].index = ranked[r].index;
+  }
+  for (size_t i = 0; i < N; i++) {
+    t->mean[i] += t->sigma * y_w[i];
+  }
+
+  // covariance^-1/2 * y_w = b * diag(1 / d) * b^T * y_w
+  double bt_y[N], c_y[N], ps_norm = 0;
+  for (size_t i = 0; i < N; i++) {
+    bt_y[i] = 0;
+    for (size_t j = 0; j < N; j++) {
+      bt_y[i] += b[j][i] * y_w[j];
+    }
+    bt_y[i] /= d[i];
+  }
+  for (size_t i = 0; i < N; i++) {
+    c_y[i] = 0;
+    for (size_t j = 0; j < N; j++) {
+      c_y[i] += b[i][j] * bt_y[j];
+    }
+    t->path_sigma[i] = (1 - cs) * t->path_sigma[i] +
+                       sqrt(cs * (2 - cs) * mueff) * c_y[i];
+    ps_norm += t->path_sigma[i] * t->path_sigma[i];
+  }
+  ps_norm = sqrt(ps_norm);
+  bool hsig = ps_norm / sqrt(1 - pow(1 - cs, 2.0 * (t->generation + 1))) /
+                  chi_n <
+              1.4 + 2 / (n + 1);
+  for (size_t i = 0; i < N; i++) {
+    t->path_c[i] = (1 - cc) * t->path_c[i] +
+                   hsig * sqrt(cc * (2 - cc) * mueff) * y_w[i];
+  }
+
+  for (size_t i = 0; i < N; i++) {
+    for (size_t j = 0; j < N; j++) {
+      double rank_mu = 0;
+      for (size_t k = 0; k < MU; k++) {
+        rank_mu += w[k] * y[ranked[k].index][i] * y[ranked[k].index][j];
+      }
+      t->covariance[i][j] =
+          (1 - c1 - cmu) * t->covariance[i][j] +
+          c1 * (t->path_c[i] * t->path_c[j] +
+                (1 - hsig) * cc * (2 - cc) * t->covariance[i][j]) +
+          cmu * rank_mu;
+    }
+  }
+  t->sigma *= exp(cs / damps * (ps_norm / chi_n - 1));
+  t->generation++;
+}
+
+int main(int argc, char **argv) {
+  const char *path = "tune.state";
+  uint64_t generations = 0, games = 1000, max_pieces = 500;
+  uint64_t threads = pool_default_threads();
+  if (argc > 6 || (argc > 1 && !arg_name(path = argv[1])) ||
+      (argc > 2 && !arg_count(argv[2], &generations)) ||
+      (argc > 3 && !arg_count(argv[3], &games)) ||
+      (argc > 4 && !arg_count(argv[4], &max_pieces)) ||
+      (argc > 5 && !arg_count(argv[5], &threads)) || games == 0) {
+    fprintf(stderr,
+            "Usage: %s [state] [generations] [games] [pieces] [threads]\n",
+            argv[0]);
+    return 1;
+  }
+
+  Tuner tuner;
+  FILE *state = fopen(path, "r");
+  if (state != NULL) {
+    bool ok = tuner_load(&tuner, state);
+    fclose(state);
+    // Rather than start over on top of it
+    if (!ok) {
+      fprintf(stderr, "Can't read the state in %s\n", path);
+      return 1;
+    }
+    printf("Resuming %s at generation %llu, best %.2f lines\n", path,
+           (unsigned long long)tuner.generation, tuner.best_fitness);
+  } else {
+    tuner_init(&tuner, 1);
+    printf("Starting %s from the default weights\n", path);
+  }
+  char log_path[4096];
+  snprintf(log_path, sizeof(log_path), "%s.log", path);
+
+  // game_init fills the Zobrist keys on first use, not from many threads
+  init_zobrist();
+  pool_init(&pool, threads);
+  Generation job = {.games = games, .max_pieces = max_pieces};
+  size_t items = (LAMBDA + 1) * games;
+  job.bots = malloc(pool_worker_count(&pool) * sizeof(Bot));
+  job.lines = malloc(items * sizeof(uint32_t));
+  job.pieces = malloc(items * sizeof(uint32_t));
+  if (job.bots == NULL || job.lines == NULL || job.pieces == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+  printf("%d + 1 vectors x %llu games of up to %llu pieces, %zu workers\n",
+         LAMBDA, (unsigned long long)games, (unsigned long long)max_pieces,
+         pool_worker_count(&pool));
+
+  for (uint64_t g = 0; generations == 0 || g < generations; g++) {
+    double start = pool_seconds();
+    double previous_best = tuner.best_fitness;
+    double mean_fitness, best_fitness, worst_fitness;
+    uint64_t pieces;
+    tuner_step(&tuner, &job, &mean_fitness, &best_fitness, &worst_fitness,
+               &pieces);
+    double seconds = pool_seconds() - start;
+
+    if (!tuner_save(&tuner, path)) {
+      fprintf(stderr, "Can't write %s\n", path);
+      return 1;
+    }
+    FILE *log = fopen(log_path, "a");
+    if (log != NULL) {
+      fprintf(log, "%llu %.3f %.3f %.3f %.5g %.3f\n",
+              (unsigned long long)tuner.generation, mean_fitness,
+              best_fitness, tuner.best_fitness, tuner.sigma, seconds);
+      fclose(log);
+    }
+    printf("generation %4llu mean %8.2f lines best %8.2f worst %8.2f "
+           "sigma %7.4f %6.2f s %9.0f games/s %11.0f pieces/s\n",
+           (unsigned long long)tuner.generation, mean_fitness, best_fitness,
+           worst_fitness, tuner.sigma, seconds, items / seconds,
+           pieces / seconds);
+    if (tuner.best_fitness > previous_best) {
+      printf("New best, %.2f lines a game:\n", tuner.best_fitness);
+      print_weights(stdout, tuner.best);
+    }
+    fflush(stdout);
+  }
+
+  free(job.bots);
+  free(job.lines);
+  free(job.pieces);
+  pool_free(&pool);
+  return 0;
+}